@@ -0,0 +1,95 @@
+
+#include <AdpcmCodec.h>
+
+#include <algorithm>
+
+static const int16_t stepTable[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+	12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t indexTable[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+//////////////////////////////////////////////
+void AdpcmCodec::encode(const int16_t *input, size_t nrSamples, AdpcmState& state, uint8_t *output)
+{
+	for (size_t i = 0; i < nrSamples; i += 2)
+	{
+		uint8_t low  = encodeSample(input[i], state);
+		uint8_t high = ((i + 1) < nrSamples) ? encodeSample(input[i + 1], state) : 0;
+		
+		output[i / 2] = low | (high << 4);
+	}
+}
+
+//////////////////////////////////////////////
+void AdpcmCodec::decode(const uint8_t *input, size_t nrSamples, AdpcmState& state, int16_t *output)
+{
+	for (size_t i = 0; i < nrSamples; i++)
+	{
+		uint8_t nibble = (i % 2 == 0) ? (input[i / 2] & 0x0F) : (input[i / 2] >> 4);
+		
+		output[i] = decodeSample(nibble, state);
+	}
+}
+
+//////////////////////////////////////////////
+uint8_t AdpcmCodec::encodeSample(int16_t sample, AdpcmState& state)
+{
+	int step  = stepTable[state.stepIndex];
+	int diff  = sample - state.predictor;
+	uint8_t nibble = 0;
+	
+	if (diff < 0)
+	{
+		nibble = 8;
+		diff   = -diff;
+	}
+	
+	if (diff >= step)
+	{
+		nibble |= 4;
+		diff   -= step;
+	}
+	
+	if (diff >= (step >> 1))
+	{
+		nibble |= 2;
+		diff   -= (step >> 1);
+	}
+	
+	if (diff >= (step >> 2))
+	{
+		nibble |= 1;
+	}
+	
+	// keep the encoder state identical to what the decoder will reconstruct
+	decodeSample(nibble, state);
+	
+	return nibble;
+}
+
+//////////////////////////////////////////////
+int16_t AdpcmCodec::decodeSample(uint8_t nibble, AdpcmState& state)
+{
+	int step = stepTable[state.stepIndex];
+	int diff = step >> 3;
+	
+	if (nibble & 4) diff += step;
+	if (nibble & 2) diff += step >> 1;
+	if (nibble & 1) diff += step >> 2;
+	
+	int predictor = state.predictor + ((nibble & 8) ? -diff : diff);
+	
+	state.predictor = (int16_t) std::min(32767, std::max(-32768, predictor));
+	state.stepIndex = (uint8_t) std::min(88, std::max(0, state.stepIndex + indexTable[nibble]));
+	
+	return state.predictor;
+}
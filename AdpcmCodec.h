@@ -0,0 +1,33 @@
+#ifndef ADPCM_CODEC_H
+#define ADPCM_CODEC_H
+
+#include <stdint.h>
+
+#include <cstddef>
+
+//////////////////////////////////////////////
+//
+// IMA ADPCM, 4 bits per 16 bit sample (low nibble first)
+//
+//////////////////////////////////////////////
+class AdpcmState
+{
+public:
+	int16_t predictor = 0;
+	uint8_t stepIndex = 0;
+};
+
+//////////////////////////////////////////////
+class AdpcmCodec
+{
+public:
+	static size_t encodedSize(size_t nrSamples) { return (nrSamples + 1) / 2; }
+	static void encode(const int16_t *input, size_t nrSamples, AdpcmState& state, uint8_t *output);
+	static void decode(const uint8_t *input, size_t nrSamples, AdpcmState& state, int16_t *output);
+	
+private:
+	static uint8_t encodeSample(int16_t sample, AdpcmState& state);
+	static int16_t decodeSample(uint8_t nibble, AdpcmState& state);
+};
+
+#endif // ADPCM_CODEC_H
@@ -0,0 +1,49 @@
+
+#include <AudioInput.h>
+#include <Metrics.h>
+
+#include <cstring>
+
+//////////////////////////////////////////////
+AudioInput::AudioInput(int inputRate, int outputRate, VADWrapper *vad) : m_resampler(inputRate, outputRate)
+{
+	m_outputRate = outputRate;
+	m_vad        = vad;
+	
+	m_hasLeftOverByte = false;
+	m_leftOverByte    = 0;
+}
+
+//////////////////////////////////////////////
+//
+// returns the status of VADWrapper::process(), -1 on error
+//
+//////////////////////////////////////////////
+int AudioInput::process(const char *data, size_t length)
+{
+	size_t carried = (m_hasLeftOverByte == true) ? 1 : 0;
+	
+	m_inputSamples.resize((carried + length) / 2);
+	
+	char *sampleBytes = (char*) m_inputSamples.data();
+	size_t usedBytes  = (m_inputSamples.size() * 2) - carried;
+	
+	if (carried > 0)
+	{
+		sampleBytes[0] = m_leftOverByte;
+	}
+	memcpy(sampleBytes + carried, data, usedBytes);
+	
+	m_hasLeftOverByte = (usedBytes < length);
+	if (m_hasLeftOverByte == true)
+	{
+		m_leftOverByte = data[length - 1];
+	}
+	
+	// resampling the whole packet, the VAD splits it into frames (and keeps an incomplete one)
+	m_resampledAudio.clear();
+	m_resampler.process(m_inputSamples.data(), m_inputSamples.size(), m_resampledAudio);
+	Metrics::getInstance().resampledSamples.inc(m_resampledAudio.size());
+	
+	return m_vad->process(m_outputRate, m_resampledAudio.data(), m_resampledAudio.size());
+}
@@ -0,0 +1,45 @@
+#ifndef AUDIO_INPUT_H
+#define AUDIO_INPUT_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <vector>
+
+#include <Resampler.h>
+#include <VADWrapper.h>
+
+//////////////////////////////////////////////
+//
+// packets as received from the client --> 16 kHz audio classified by the VAD
+//
+// the server sends 16 bit samples, but a packet may end within a sample:
+// its first byte is kept and completed by the next packet; every packet,
+// the first one included, is resampled and handed to the VAD right away
+//
+//////////////////////////////////////////////
+class AudioInput
+{
+public:
+	AudioInput(int inputRate, int outputRate, VADWrapper *vad);
+	int process(const char *data, size_t length);
+	
+private:
+	int m_outputRate;
+	
+	// frames are taken out of the VAD by its owner
+	VADWrapper *m_vad;
+	
+	// any input rate --> processing rate
+	Resampler m_resampler;
+	
+	// the current packet as received, plus a byte left over from the previous one (capacity is kept between packets)
+	std::vector<int16_t> m_inputSamples;
+	bool m_hasLeftOverByte;
+	char m_leftOverByte;
+	
+	// the current packet at the output rate (capacity is kept between packets)
+	std::vector<int16_t> m_resampledAudio;
+};
+
+#endif // AUDIO_INPUT_H
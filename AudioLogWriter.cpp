@@ -0,0 +1,402 @@
+
+#include <AudioLogWriter.h>
+#include <AdpcmCodec.h>
+#include <Metrics.h>
+#include <VoskConfig.h>
+
+#include <Log.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// written utterances keep their buffer for reuse, a few are enough
+static const size_t maxSpareBuffers = 16;
+
+// every archived utterance starts with magic, number of samples and the initial ADPCM state
+static const char   archiveMagic[4]    = { 'V', 'W', 'A', '1' };
+static const size_t archiveHeaderBytes = 12;
+
+//////////////////////////////////////////////
+AudioLogWriter& AudioLogWriter::getInstance(void)
+{
+	static AudioLogWriter instance;
+	return instance;
+}
+
+//////////////////////////////////////////////
+AudioLogWriter::AudioLogWriter(void)
+{
+	m_maxQueued = 64;
+	m_policy    = AudioLogOverflowPolicy::DROP;
+	m_dropped   = 0;
+	m_shutdown  = false;
+	
+	m_archive         = false;
+	m_maxSegmentBytes = 64 * 1024 * 1024;
+	m_segmentFd       = -1;
+	m_indexFd         = -1;
+	m_segmentBytes    = 0;
+	
+	VoskConfig& config = VoskConfig::getInstance();
+	
+	m_archive         = config.getBool("log_archive", m_archive);
+	m_maxSegmentBytes = (size_t) config.getInt("log_archive_segment_mb", 64) * 1024 * 1024;
+	m_maxQueued       = std::max(1, config.getInt("log_queue", (int) m_maxQueued));
+	m_policy          = (config.getString("log_overflow", "drop") == "block") ? AudioLogOverflowPolicy::BLOCK : AudioLogOverflowPolicy::DROP;
+	
+	// the log sink has to outlive the writer thread, which still logs while draining at exit
+	Log::getInstance();
+	
+	m_writer = std::thread(&AudioLogWriter::writerLoop, this);
+}
+
+//////////////////////////////////////////////
+//
+// everything queued so far is still written
+//
+//////////////////////////////////////////////
+AudioLogWriter::~AudioLogWriter(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	
+	m_queueFilled.notify_all();
+	m_writer.join();
+	
+	closeSegment();
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::configure(size_t maxQueued, AudioLogOverflowPolicy policy)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	m_maxQueued = (maxQueued > 0) ? maxQueued : 1;
+	m_policy    = policy;
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::setArchiveMode(bool enabled, size_t maxSegmentBytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	m_archive         = enabled;
+	m_maxSegmentBytes = maxSegmentBytes;
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::write(std::string logPath, std::unique_ptr<LoggedUtterance> utterance)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	if (m_queue.size() >= m_maxQueued)
+	{
+		if (m_policy == AudioLogOverflowPolicy::DROP)
+		{
+			m_dropped++;
+			Metrics::getInstance().audioLogDropped.inc();
+			LOG_WARNING << "AudioLogWriter queue full, dropping " << utterance->filename << " (" << m_dropped << " dropped so far)";
+			return;
+		}
+		
+		m_queueDrained.wait(lock, [this] { return (m_queue.size() < m_maxQueued); });
+	}
+	
+	m_queue.emplace_back(std::move(logPath), std::move(utterance));
+	
+	lock.unlock();
+	m_queueFilled.notify_one();
+}
+
+//////////////////////////////////////////////
+//
+// an empty buffer, but with capacity from an utterance written before (if available)
+//
+//////////////////////////////////////////////
+std::vector<short> AudioLogWriter::getSpareBuffer(void)
+{
+	std::vector<short> buffer;
+	
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (m_spareBuffers.size() > 0)
+	{
+		buffer.swap(m_spareBuffers.back());
+		m_spareBuffers.pop_back();
+	}
+	
+	return buffer;
+}
+
+//////////////////////////////////////////////
+unsigned long long AudioLogWriter::getDroppedUtterances(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_dropped;
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::writerLoop(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	while (true)
+	{
+		m_queueFilled.wait(lock, [this] { return (m_shutdown == true) || (m_queue.size() > 0); });
+		
+		if (m_queue.size() == 0)
+		{
+			// shutdown and nothing left to write
+			break;
+		}
+		
+		std::string logPath = std::move(m_queue.front().first);
+		std::unique_ptr<LoggedUtterance> utterance = std::move(m_queue.front().second);
+		m_queue.pop_front();
+		
+		bool archive = m_archive;
+		
+		lock.unlock();
+		m_queueDrained.notify_all();
+		
+		if (archive == true)
+		{
+			appendToArchive(logPath, utterance.get());
+		}
+		else
+		{
+			closeSegment();
+			writeFiles(logPath, utterance.get());
+		}
+		
+		utterance->samples.clear();
+		
+		lock.lock();
+		
+		if (m_spareBuffers.size() < maxSpareBuffers)
+		{
+			m_spareBuffers.push_back(std::move(utterance->samples));
+		}
+	}
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::writeFiles(const std::string& logPath, LoggedUtterance *utterance)
+{
+	LOG_DEBUG << "Logging " << utterance->samples.size() << " samples to file " << utterance->filename << " utterance " << utterance->text;
+	
+	if ((utterance->filename.size() == 0) || (utterance->samples.size() == 0))
+	{
+		return;
+	}
+	
+	writeFile(logPath + utterance->filename + ".raw", (const char*) utterance->samples.data(), utterance->samples.size() * sizeof(short));
+	
+	// reused, so no allocation once it has grown to the longest text
+	m_textBuffer.assign(utterance->text);
+	m_textBuffer += '\n';
+	
+	writeFile(logPath + utterance->filename + ".txt", m_textBuffer.data(), m_textBuffer.size());
+}
+
+//////////////////////////////////////////////
+bool AudioLogWriter::writeFile(const std::string& path, const char *data, size_t length)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd < 0)
+	{
+		LOG_ERROR << "Error opening " << path << " for writing!";
+		return false;
+	}
+	
+	if (writeAll(fd, data, length) == false)
+	{
+		LOG_ERROR << "Error writing file " << path;
+		close(fd);
+		return false;
+	}
+	
+	close(fd);
+	return true;
+}
+
+//////////////////////////////////////////////
+//
+// short writes and interrupted calls are continued, the index relies on
+// complete records
+//
+//////////////////////////////////////////////
+bool AudioLogWriter::writeAll(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t written = ::write(fd, data, length);
+		
+		if ((written < 0) && (errno == EINTR))
+		{
+			continue;
+		}
+		
+		if (written <= 0)
+		{
+			return false;
+		}
+		
+		data   += written;
+		length -= written;
+	}
+	
+	return true;
+}
+
+//////////////////////////////////////////////
+//
+// starts a new segment and its index, named after the current time
+//
+//////////////////////////////////////////////
+bool AudioLogWriter::openSegment(const std::string& logPath)
+{
+	std::ostringstream os;
+	
+	auto t = std::time(nullptr);
+	auto tm = *std::localtime(&t);
+	
+	os << logPath << "archive_" << std::put_time(&tm, "%y%m%d_%H%M%S");
+	
+	std::string basename = os.str();
+	
+	// more than one segment per second: make the name unique
+	for (int i = 1; access((basename + ".adpcm").c_str(), F_OK) == 0; i++)
+	{
+		basename = os.str() + "_" + std::to_string(i);
+	}
+	
+	m_segmentFd = open((basename + ".adpcm").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	m_indexFd   = open((basename + ".idx").c_str(),   O_WRONLY | O_CREAT | O_APPEND, 0644);
+	
+	if ((m_segmentFd < 0) || (m_indexFd < 0))
+	{
+		LOG_ERROR << "Error opening archive segment " << basename << " for writing!";
+		closeSegment();
+		return false;
+	}
+	
+	LOG_INFO << "AudioLogWriter, new archive segment " << basename;
+	
+	m_segmentLogPath = logPath;
+	m_segmentBytes   = 0;
+	
+	const char *indexHeader = "# offset\tbytes\tsamples\tstart_ms\tinstance\tname\ttext\n";
+	writeAll(m_indexFd, indexHeader, strlen(indexHeader));
+	
+	return true;
+}
+
+//////////////////////////////////////////////
+void AudioLogWriter::closeSegment(void)
+{
+	if (m_segmentFd >= 0)
+	{
+		close(m_segmentFd);
+		m_segmentFd = -1;
+	}
+	
+	if (m_indexFd >= 0)
+	{
+		close(m_indexFd);
+		m_indexFd = -1;
+	}
+	
+	m_segmentLogPath.clear();
+}
+
+//////////////////////////////////////////////
+//
+// appends one compressed utterance to the current segment and indexes it
+//
+//////////////////////////////////////////////
+void AudioLogWriter::appendToArchive(const std::string& logPath, LoggedUtterance *utterance)
+{
+	LOG_DEBUG << "Archiving " << utterance->samples.size() << " samples of " << utterance->filename << " utterance " << utterance->text;
+	
+	if (utterance->samples.size() == 0)
+	{
+		return;
+	}
+	
+	size_t recordBytes = archiveHeaderBytes + AdpcmCodec::encodedSize(utterance->samples.size());
+	
+	if ((m_segmentFd >= 0) && ((m_segmentLogPath != logPath) || ((m_segmentBytes + recordBytes) > m_maxSegmentBytes)))
+	{
+		closeSegment();
+	}
+	
+	if ((m_segmentFd < 0) && (openSegment(logPath) == false))
+	{
+		return;
+	}
+	
+	AdpcmState state;
+	uint32_t   nrSamples = utterance->samples.size();
+	
+	// reused, so no allocation once it has grown to the longest utterance
+	m_encodeBuffer.resize(recordBytes);
+	
+	memcpy(m_encodeBuffer.data(), archiveMagic, sizeof(archiveMagic));
+	memcpy(m_encodeBuffer.data() + 4, &nrSamples, sizeof(nrSamples));
+	memcpy(m_encodeBuffer.data() + 8, &state.predictor, sizeof(state.predictor));
+	m_encodeBuffer[10] = (char) state.stepIndex;
+	m_encodeBuffer[11] = 0;
+	
+	AdpcmCodec::encode(utterance->samples.data(), nrSamples, state, (uint8_t*) m_encodeBuffer.data() + archiveHeaderBytes);
+	
+	size_t offset = m_segmentBytes;
+	
+	if (writeAll(m_segmentFd, m_encodeBuffer.data(), recordBytes) == false)
+	{
+		LOG_ERROR << "Error writing archive segment, starting a new one";
+		closeSegment();
+		return;
+	}
+	
+	m_segmentBytes += recordBytes;
+	
+	long long startMs = std::chrono::duration_cast<std::chrono::milliseconds>(utterance->startTime.time_since_epoch()).count();
+	
+	m_textBuffer.clear();
+	m_textBuffer += std::to_string(offset);                 m_textBuffer += '\t';
+	m_textBuffer += std::to_string(recordBytes);            m_textBuffer += '\t';
+	m_textBuffer += std::to_string(nrSamples);              m_textBuffer += '\t';
+	m_textBuffer += std::to_string(startMs);                m_textBuffer += '\t';
+	m_textBuffer += std::to_string(utterance->instanceId);  m_textBuffer += '\t';
+	m_textBuffer += utterance->filename;                    m_textBuffer += '\t';
+	
+	// one utterance per line, so tabs and line breaks in the text are escaped
+	for (char c : utterance->text)
+	{
+		switch (c)
+		{
+			case '\t': m_textBuffer += "\\t"; break;
+			case '\n': m_textBuffer += "\\n"; break;
+			case '\\': m_textBuffer += "\\\\"; break;
+			default:   m_textBuffer += c;     break;
+		}
+	}
+	m_textBuffer += '\n';
+	
+	if (writeAll(m_indexFd, m_textBuffer.data(), m_textBuffer.size()) == false)
+	{
+		LOG_ERROR << "Error writing archive index";
+	}
+}
@@ -0,0 +1,101 @@
+#ifndef AUDIO_LOG_WRITER_H
+#define AUDIO_LOG_WRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////
+//
+// audio of one utterance, kept until its text is known
+//
+//////////////////////////////////////////////
+class LoggedUtterance
+{
+public:
+	std::string filename;
+	std::vector<short> samples;
+	std::string text;
+	
+	int instanceId;
+	std::chrono::system_clock::time_point startTime;
+};
+
+// what to do if the disk can't keep up and the queue is full
+enum AudioLogOverflowPolicy {DROP, BLOCK};
+
+//////////////////////////////////////////////
+//
+// process-wide background thread writing the utterances of all AudioLoggers
+//
+// the queue is bounded: depending on the policy, utterances that don't fit
+// are dropped (and counted) or the caller waits until there is space
+//
+// by default every utterance becomes a .raw and a .txt file; in archive mode
+// utterances are appended IMA ADPCM compressed to rolling segment files
+// (archive_<date>.adpcm), each with a text index (archive_<date>.idx) of
+//
+// offset  bytes  samples  start_ms  instance  name  text
+//
+// so that tools/archive_extract.cpp can seek to a single utterance
+//
+//////////////////////////////////////////////
+class AudioLogWriter
+{
+public:
+	static AudioLogWriter& getInstance(void);
+	
+	void configure(size_t maxQueued, AudioLogOverflowPolicy policy);
+	void setArchiveMode(bool enabled, size_t maxSegmentBytes);
+	void write(std::string logPath, std::unique_ptr<LoggedUtterance> utterance);
+	std::vector<short> getSpareBuffer(void);
+	unsigned long long getDroppedUtterances(void);
+	
+private:
+	AudioLogWriter(void);
+	~AudioLogWriter(void);
+	
+	void writerLoop(void);
+	void writeFiles(const std::string& logPath, LoggedUtterance *utterance);
+	bool writeFile(const std::string& path, const char *data, size_t length);
+	void appendToArchive(const std::string& logPath, LoggedUtterance *utterance);
+	bool openSegment(const std::string& logPath);
+	void closeSegment(void);
+	static bool writeAll(int fd, const char *data, size_t length);
+	
+	std::mutex              m_mutex;
+	std::condition_variable m_queueFilled;
+	std::condition_variable m_queueDrained;
+	
+	std::deque<std::pair<std::string, std::unique_ptr<LoggedUtterance>>> m_queue;
+	size_t                 m_maxQueued;
+	AudioLogOverflowPolicy m_policy;
+	unsigned long long     m_dropped;
+	
+	// sample buffers of written utterances, handed out again to the loggers
+	std::vector<std::vector<short>> m_spareBuffers;
+	
+	// archive mode
+	bool   m_archive;
+	size_t m_maxSegmentBytes;
+	
+	// only used by the writer thread
+	std::string m_textBuffer;
+	std::vector<char> m_encodeBuffer;
+	
+	// currently open archive segment (writer thread only)
+	std::string m_segmentLogPath;
+	int    m_segmentFd;
+	int    m_indexFd;
+	size_t m_segmentBytes;
+	
+	std::thread m_writer;
+	bool        m_shutdown;
+};
+
+#endif // AUDIO_LOG_WRITER_H
@@ -1,11 +1,11 @@
 
-#include <iostream>
-
 #include <AudioLogger.h>
+#include <Log.h>
 
+#include <algorithm>
 #include <filesystem>
-#include <ios>
-#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <string>
 
 //////////////////////////////////////////////
@@ -17,93 +17,130 @@ AudioLogger::AudioLogger(std::string logPath, int instanceId)
 	// although directory should already exist
 	std::filesystem::create_directories(logPath);
 	
-	chunks.clear();
+	samples.clear();
 	filename.clear();
 	idx = 0;
+	nextUtteranceId = 0;
 }
 
 //////////////////////////////////////////////
 AudioLogger::~AudioLogger(void)
 {
-	chunks.clear();
+	samples.clear();
+	closedUtterances.clear();
 }
 
 //////////////////////////////////////////////
-void AudioLogger::addChunk(std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> chunk)
+void AudioLogger::startUtterance(std::chrono::system_clock::time_point start)
+{
+	std::ostringstream os;
+	
+	auto t = std::time(nullptr);
+	auto tm = *std::localtime(&t);
+	
+	os << std::put_time(&tm, "%d%m%y_%H%M%S") << "_" << m_instanceId << "_" << (idx++);
+	
+	filename  = os.str();
+	startTime = start;
+}
+
+//////////////////////////////////////////////
+void AudioLogger::addChunk(const VADFrame<VADWrapper::nrVADSamples>& chunk)
 {
 	if (filename.size() == 0)
 	{
-		std::ostringstream os;
-		
-		auto t = std::time(nullptr);
-		auto tm = *std::localtime(&t);
-		
-		os << std::put_time(&tm, "%d%m%y_%H%M%S") << "_" << m_instanceId << "_" << (idx++);
+		startUtterance(std::chrono::system_clock::now());
+	}
+	
+	samples.insert(samples.end(), std::begin(chunk.samples), std::end(chunk.samples));
+}
+
+//////////////////////////////////////////////
+//
+// the current utterance is complete, keep its audio until flush() gets its text
+//
+// returns the id to be passed to flush()
+//
+//////////////////////////////////////////////
+unsigned long long AudioLogger::closeUtterance(void)
+{
+	return closeUtterance(samples.size());
+}
+
+//////////////////////////////////////////////
+//
+// only the first nrSamples are the utterance (a piece of a split one),
+// the samples after them start the next utterance
+//
+//////////////////////////////////////////////
+unsigned long long AudioLogger::closeUtterance(size_t nrSamples)
+{
+	std::unique_ptr<LoggedUtterance> utterance = std::make_unique<LoggedUtterance>();
+	unsigned long long utteranceId = nextUtteranceId++;
+	
+	nrSamples = std::min(nrSamples, samples.size());
+	
+	utterance->filename   = filename;
+	utterance->instanceId = m_instanceId;
+	utterance->startTime  = startTime;
+	utterance->samples.swap(samples);
+	
+	samples.clear();
+	filename.clear();
+	
+	// continue with a buffer that already has capacity
+	samples = AudioLogWriter::getInstance().getSpareBuffer();
+	
+	if (nrSamples < utterance->samples.size())
+	{
+		samples.assign(utterance->samples.begin() + nrSamples, utterance->samples.end());
+		utterance->samples.resize(nrSamples);
 		
-		filename = os.str();
+		// frames are 10 ms
+		startUtterance(utterance->startTime + std::chrono::milliseconds((nrSamples * 10) / VADWrapper::nrVADSamples));
 	}
 	
-	chunks.push_back(std::move(chunk));
+	std::lock_guard<std::mutex> lock(m_closedMutex);
+	closedUtterances[utteranceId] = std::move(utterance);
+	
+	return utteranceId;
+}
+
+//////////////////////////////////////////////
+//
+// the current utterance is not decoded (too short), nothing gets logged
+//
+//////////////////////////////////////////////
+void AudioLogger::discardUtterance(void)
+{
+	samples.clear();
+	filename.clear();
 }
 
 //////////////////////////////////////////////
-void AudioLogger::flush(std::string resultText)
+//
+// hands the utterance with its text over to the background writer
+//
+//////////////////////////////////////////////
+void AudioLogger::flush(unsigned long long utteranceId, std::string resultText)
 {
-	std::cout << "Logging " << chunks.size() << " chunks to file " << filename << " utterance " << resultText << std::endl;
+	std::unique_ptr<LoggedUtterance> utterance;
 	
-	if (filename.size() > 0)
 	{
-		if (chunks.size() > 0)
+		std::lock_guard<std::mutex> lock(m_closedMutex);
+		
+		auto it = closedUtterances.find(utteranceId);
+		if (it == closedUtterances.end())
 		{
-			std::string audioFilename = m_logPath + filename + ".raw";
-			std::ofstream audioStream(audioFilename.c_str(), std::ofstream::out | std::ofstream::binary);
-			
-			if ((audioStream.rdstate() & (std::ofstream::failbit | std::ofstream::badbit)) != 0)
-			{
-				std::cout << "Error opening " << audioFilename << " for writing!" << std::endl;
-			}
-			else
-			{
-				bool isGood = true;
-				
-				while ((chunks.size() > 0) && (isGood == true))
-				{
-					std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> chunk = std::move(chunks.front());
-					chunks.pop_front();
-					audioStream.write((const char*) chunk->samples, sizeof(chunk->samples));
-					
-					isGood = audioStream.good();
-				}
-			
-				if (isGood == false)
-				{
-					std::cout << "Error writing audio file " << audioFilename << std::endl;	
-				}
-				
-				audioStream.close();
-			}
-			
-			std::string textFilename = m_logPath + filename + ".txt";
-			std::ofstream textStream(textFilename.c_str(), std::ofstream::out);
-			
-			if ((textStream.rdstate() & (std::ofstream::failbit | std::ofstream::badbit)) != 0)
-			{
-				std::cout << "Error opening " << textFilename << " for writing!" << std::endl;
-			}
-			else
-			{
-				textStream << resultText << std::endl;
-			
-				if (textStream.good() == false)
-				{
-					std::cout << "Error writing text file " << textFilename << std::endl;	
-				}
-				
-				textStream.close();
-			}
+			LOG_WARNING << "No logged audio for utterance " << utteranceId;
+			return;
 		}
+		
+		utterance = std::move(it->second);
+		closedUtterances.erase(it);
 	}
 	
-	chunks.clear();
-	filename.clear();
+	utterance->text = resultText;
+	
+	AudioLogWriter::getInstance().write(m_logPath, std::move(utterance));
 }
@@ -1,11 +1,15 @@
 #ifndef AUDIO_LOGGER_H
 #define AUDIO_LOGGER_H
 
-#include <deque>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <VADWrapper.h>
+#include <AudioLogWriter.h>
 
 
 //////////////////////////////////////////////
@@ -14,14 +18,26 @@ class AudioLogger
 public:
 	AudioLogger(std::string logPath, int instanceId);
 	~AudioLogger(void);
-	void addChunk(std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> chunk);
-	void flush(std::string resultText);
+	void addChunk(const VADFrame<VADWrapper::nrVADSamples>& chunk);
+	unsigned long long closeUtterance(void);
+	unsigned long long closeUtterance(size_t nrSamples);
+	void discardUtterance(void);
+	void flush(unsigned long long utteranceId, std::string resultText);
 private:
+	void startUtterance(std::chrono::system_clock::time_point start);
+	
 	int m_instanceId;
 	std::string m_logPath;
-	std::deque<std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>>> chunks;
+	// samples of the current utterance, the buffer is reused
+	std::vector<short> samples;
 	std::string filename;
+	std::chrono::system_clock::time_point startTime;
 	unsigned long long idx;
+	
+	// utterances waiting for their text (decoding runs in the background)
+	std::mutex m_closedMutex;
+	unsigned long long nextUtteranceId;
+	std::map<unsigned long long, std::unique_ptr<LoggedUtterance>> closedUtterances;
 };
 
 #endif // AUDIO_LOGGER_H
@@ -0,0 +1,87 @@
+#include <DecoderPool.h>
+#include <Log.h>
+#include <Metrics.h>
+
+#include <cassert>
+
+//////////////////////////////////////////////
+DecoderPool::DecoderPool(struct whisper_context* ctx, unsigned int maxStates)
+{
+	assert(maxStates > 0);
+	
+	m_ctx       = ctx;
+	m_maxStates = maxStates;
+	m_created   = 0;
+	
+	m_free.reserve(maxStates);
+}
+
+//////////////////////////////////////////////
+DecoderPool::~DecoderPool(void)
+{
+	// all leases must have ended, the scheduler is idle for this model
+	assert(m_free.size() == m_created);
+	
+	for (struct whisper_state* state : m_free)
+	{
+		whisper_free_state(state);
+	}
+	
+	Metrics::getInstance().decoderStates.add(-((int64_t) m_created));
+}
+
+//////////////////////////////////////////////
+//
+// returns a free state, creates one if none is free and the limit allows it,
+// otherwise waits for one
+//
+//////////////////////////////////////////////
+struct whisper_state* DecoderPool::lease(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	if ((m_free.size() == 0) && (m_created < m_maxStates))
+	{
+		m_created++;
+		
+		// creating allocates the buffers, don't block the other leases meanwhile
+		lock.unlock();
+		struct whisper_state* state = whisper_init_state(m_ctx);
+		lock.lock();
+		
+		if (state == nullptr)
+		{
+			LOG_ERROR << "DecoderPool, failed to create whisper state";
+			Log::getInstance().abortProcess();
+		}
+		
+		LOG_INFO << "DecoderPool, created whisper state " << m_created << " of at most " << m_maxStates;
+		
+		Metrics::getInstance().decoderStates.add(1);
+		Metrics::getInstance().decoderStatesBusy.add(1);
+		
+		return state;
+	}
+	
+	m_stateReturned.wait(lock, [this] { return (m_free.size() > 0); });
+	
+	struct whisper_state* state = m_free.back();
+	m_free.pop_back();
+	
+	Metrics::getInstance().decoderStatesBusy.add(1);
+	
+	return state;
+}
+
+//////////////////////////////////////////////
+void DecoderPool::giveBack(struct whisper_state* state)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push_back(state);
+	}
+	
+	Metrics::getInstance().decoderStatesBusy.add(-1);
+	
+	m_stateReturned.notify_one();
+}
@@ -0,0 +1,63 @@
+#ifndef DECODER_POOL_H
+#define DECODER_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "whisper.h"
+
+//////////////////////////////////////////////
+//
+// whisper decoding states (KV caches, mel and encoder buffers) of one model
+//
+// a state is only needed while whisper_full runs, so the scheduler leases one
+// per decode instead of every recognizer keeping its own; memory grows with
+// the decodes running at the same time, not with the connected sessions
+//
+// states are created on first demand up to the limit and kept afterwards,
+// with the limit reached a lease waits until another decode gives one back
+//
+//////////////////////////////////////////////
+class DecoderPool
+{
+public:
+	DecoderPool(struct whisper_context* ctx, unsigned int maxStates);
+	~DecoderPool(void);
+	
+	struct whisper_state* lease(void);
+	void giveBack(struct whisper_state* state);
+	
+private:
+	struct whisper_context* m_ctx;
+	unsigned int m_maxStates;
+	
+	std::mutex              m_mutex;
+	std::condition_variable m_stateReturned;
+	
+	std::vector<struct whisper_state*> m_free;
+	unsigned int m_created;
+};
+
+//////////////////////////////////////////////
+//
+// a state leased for the lifetime of the object
+//
+//////////////////////////////////////////////
+class DecoderLease
+{
+public:
+	DecoderLease(DecoderPool& pool) : m_pool(pool), m_state(pool.lease()) {}
+	~DecoderLease(void) { m_pool.giveBack(m_state); }
+	
+	DecoderLease(const DecoderLease&) = delete;
+	DecoderLease& operator=(const DecoderLease&) = delete;
+	
+	struct whisper_state* get(void) { return m_state; }
+	
+private:
+	DecoderPool&          m_pool;
+	struct whisper_state* m_state;
+};
+
+#endif // DECODER_POOL_H
@@ -0,0 +1,1140 @@
+
+#include <InferenceScheduler.h>
+#include <AudioLogWriter.h>
+#include <VoskRecognizer.h>
+#include <Metrics.h>
+#include <VoskConfig.h>
+
+#include <Log.h>
+#include <algorithm>
+
+// whisper hardly scales beyond a few threads per decode,
+// running more decodes in parallel uses the cores better
+static const unsigned int maxThreadsPerDecode = 4;
+
+// batching: utterances packed into one 30 second window, separated by silence
+static const size_t samplesPerWindow      = WHISPER_CHUNK_SIZE * WHISPER_SAMPLE_RATE;
+static const size_t batchGapSamples       = WHISPER_SAMPLE_RATE;
+static const size_t maxBatchableSamples   = 8 * WHISPER_SAMPLE_RATE;
+
+// whisper timestamps are in units of 10 ms
+static const size_t samplesPerTimestamp   = WHISPER_SAMPLE_RATE / 100;
+static const unsigned int msPerTimestamp  = 10;
+
+// the encoder halves the mel frames, one encoder frame is 20 ms
+static const size_t samplesPerEncoderFrame = 2 * WHISPER_HOP_LENGTH;
+
+//////////////////////////////////////////////
+InferenceScheduler& InferenceScheduler::getInstance(void)
+{
+	static InferenceScheduler instance;
+	return instance;
+}
+
+//////////////////////////////////////////////
+InferenceScheduler::InferenceScheduler(void)
+{
+	unsigned int nrCores = std::thread::hardware_concurrency();
+	
+	if (nrCores == 0)
+	{
+		nrCores = 1;
+	}
+	
+	VoskConfig& config = VoskConfig::getInstance();
+	
+	// 0: sized to the machine
+	int threads = config.getInt("threads", 0);
+	int workers = config.getInt("workers", 0);
+	
+	m_threadsPerDecode = (threads > 0) ? (unsigned int) threads : std::min(nrCores, maxThreadsPerDecode);
+	m_nrWorkers        = (workers > 0) ? (unsigned int) workers : std::max(1u, nrCores / m_threadsPerDecode);
+	
+	LOG_INFO << "InferenceScheduler, " << nrCores << " cores, " << m_nrWorkers << " workers with " << m_threadsPerDecode << " threads each";
+	
+	// off by default, see the header
+	m_maxBatchSize = std::max(1, config.getInt("batch_size", 1));
+	m_maxBatchWait = std::chrono::milliseconds(std::max(0, config.getInt("batch_wait_ms", 100)));
+	
+	// 0: enough to keep every worker busy for a while
+	int maxPending = config.getInt("max_pending", 0);
+	m_maxPending           = (maxPending > 0) ? (size_t) maxPending : (size_t) (8 * m_nrWorkers);
+	m_maxPendingPerSession = (size_t) std::max(1, config.getInt("max_pending_per_session", 3));
+	
+	std::string policy = config.getString("overload_policy", "drop_oldest");
+	m_overloadPolicy = OVERLOAD_DROP_OLDEST;
+	if (policy == "degrade")
+	{
+		m_overloadPolicy = OVERLOAD_DEGRADE;
+	}
+	else if (policy == "reject")
+	{
+		m_overloadPolicy = OVERLOAD_REJECT;
+	}
+	else if (policy != "drop_oldest")
+	{
+		LOG_WARNING << "Unknown overload_policy " << policy << ", using drop_oldest";
+		policy = "drop_oldest";
+	}
+	
+	LOG_INFO << "InferenceScheduler, at most " << m_maxPending << " utterances waiting, " << m_maxPendingPerSession << " per session, overload policy " << policy;
+	
+	std::string schedule = config.getString("schedule_policy", "edf");
+	m_schedulePolicy = SCHEDULE_EDF;
+	if (schedule == "fifo")
+	{
+		m_schedulePolicy = SCHEDULE_FIFO;
+	}
+	else if (schedule == "sjf")
+	{
+		m_schedulePolicy = SCHEDULE_SJF;
+	}
+	else if (schedule != "edf")
+	{
+		LOG_WARNING << "Unknown schedule_policy " << schedule << ", using edf";
+		schedule = "edf";
+	}
+	
+	m_deadlineBase           = std::chrono::milliseconds(std::max(0, config.getInt("deadline_ms", 1000)));
+	m_deadlinePerAudioSecond = std::chrono::milliseconds(std::max(0, config.getInt("deadline_ms_per_s", 250)));
+	
+	LOG_INFO << "InferenceScheduler, schedule policy " << schedule << ", deadline " << m_deadlineBase.count() << " ms + "
+		<< m_deadlinePerAudioSecond.count() << " ms per second of audio";
+	
+	m_overloaded = false;
+	
+	m_shutdown = false;
+	
+	// the log sink, the metrics and the audio log writer (flushed by delivered
+	// results) have to outlive the workers
+	Log::getInstance();
+	Metrics::getInstance();
+	AudioLogWriter::getInstance();
+	
+	for (unsigned int i = 0; i < m_nrWorkers; i++)
+	{
+		m_workers.emplace_back(&InferenceScheduler::workerLoop, this);
+	}
+}
+
+//////////////////////////////////////////////
+InferenceScheduler::~InferenceScheduler(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	
+	m_jobAvailable.notify_all();
+	
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+	
+	m_queue.clear();
+}
+
+//////////////////////////////////////////////
+void InferenceScheduler::submit(std::unique_ptr<DecodeJob> job)
+{
+	setDeadline(job.get());
+	
+	// partial results are the first thing to give up when decoding falls behind
+	if ((job->isPartial == true) && (isOverloaded() == true))
+	{
+		return;
+	}
+	
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		VoskRecognizer *owner = job->owner;
+		
+		// a partial result that was not decoded yet is outdated now
+		m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(),
+			[owner](const std::unique_ptr<DecodeJob>& queued) { return (queued->owner == owner) && (queued->isPartial == true); }), m_queue.end());
+		
+		if (job->isPartial == false)
+		{
+			admit(job.get());
+		}
+		
+		m_queue.push_back(std::move(job));
+		
+		queueChanged();
+	}
+	
+	// also wakes a worker that is collecting a batch
+	m_jobAvailable.notify_all();
+}
+
+//////////////////////////////////////////////
+//
+// drops all queued jobs of this recognizer and waits until the one
+// currently being decoded (if any) has finished
+//
+// must be called before the recognizer is freed
+//
+//////////////////////////////////////////////
+void InferenceScheduler::cancel(VoskRecognizer *owner)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(),
+		[owner](const std::unique_ptr<DecodeJob>& job) { return job->owner == owner; }), m_queue.end());
+	
+	queueChanged();
+	
+	m_jobDone.wait(lock, [this, owner] { return (m_busy.count(owner) == 0); });
+}
+
+//////////////////////////////////////////////
+//
+// waits until all jobs of this recognizer are decoded and delivered
+//
+//////////////////////////////////////////////
+void InferenceScheduler::waitIdle(VoskRecognizer *owner)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	m_jobDone.wait(lock, [this, owner] { return (hasPendingJobs(owner) == false); });
+}
+
+//////////////////////////////////////////////
+bool InferenceScheduler::hasPendingJobs(VoskRecognizer *owner)
+{
+	if (m_busy.count(owner) > 0)
+	{
+		return true;
+	}
+	
+	for (const auto& job : m_queue)
+	{
+		if (job->owner == owner)
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+//////////////////////////////////////////////
+//
+// complete utterances still to be decoded (dropped ones don't count),
+// of this recognizer and of all
+//
+//////////////////////////////////////////////
+void InferenceScheduler::countPending(VoskRecognizer *owner, size_t& ownerPending, size_t& totalPending)
+{
+	ownerPending = 0;
+	totalPending = 0;
+	
+	for (const auto& job : m_queue)
+	{
+		if ((job->isPartial == true) || (job->dropped == true))
+		{
+			continue;
+		}
+		
+		totalPending++;
+		
+		if (job->owner == owner)
+		{
+			ownerPending++;
+		}
+	}
+}
+
+//////////////////////////////////////////////
+//
+// applies the overload policy before a complete utterance is queued
+//
+//////////////////////////////////////////////
+void InferenceScheduler::admit(DecodeJob *job)
+{
+	size_t ownerPending, totalPending;
+	
+	countPending(job->owner, ownerPending, totalPending);
+	
+	bool ownerFull = (ownerPending >= m_maxPendingPerSession);
+	bool totalFull = (totalPending >= m_maxPending);
+	
+	if ((ownerFull == false) && (totalFull == false))
+	{
+		return;
+	}
+	
+	// cheaper decodes drain the queue faster, but it must not grow without bound either
+	if ((m_overloadPolicy == OVERLOAD_DEGRADE) && (ownerPending < (2 * m_maxPendingPerSession)) && (totalPending < (2 * m_maxPending)))
+	{
+		degrade(job);
+		
+		for (auto& queued : m_queue)
+		{
+			if ((queued->isPartial == false) && (queued->dropped == false) && ((totalFull == true) || (queued->owner == job->owner)))
+			{
+				degrade(queued.get());
+			}
+		}
+		
+		return;
+	}
+	
+	dropOldest((totalFull == true) ? nullptr : job->owner);
+}
+
+//////////////////////////////////////////////
+//
+// the oldest waiting complete utterance (of this recognizer or of any if
+// nullptr) stays queued without its audio, so that its recognizer learns
+// about it in order with its other results
+//
+// the jobs of a recognizer before its oldest waiting utterance can only be
+// dropped ones, so the new one is merged into the one right before it: under
+// sustained overload the queue holds at most one dropped entry per recognizer
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::dropOldest(VoskRecognizer *owner)
+{
+	for (auto it = m_queue.begin(); it != m_queue.end(); it++)
+	{
+		DecodeJob *queued = it->get();
+		
+		if ((queued->isPartial == true) || (queued->dropped == true))
+		{
+			continue;
+		}
+		
+		if ((owner != nullptr) && (queued->owner != owner))
+		{
+			continue;
+		}
+		
+		LOG_WARNING << "Overload, dropping utterance of instance " << queued->owner->getInstanceId() << " waiting for "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - queued->arrival).count() << " s";
+		
+		Metrics::getInstance().utterancesDropped.inc();
+		
+		// the pieces of an utterance are completed by its last one, a completed
+		// utterance must not be continued by the pieces of the next one
+		auto previous = m_queue.end();
+		for (auto pit = m_queue.begin(); pit != it; pit++)
+		{
+			if ((*pit)->owner == queued->owner)
+			{
+				previous = pit;
+			}
+		}
+		
+		bool merge = (previous != m_queue.end()) && ((*previous)->dropped == true) &&
+			(((*previous)->isLastPiece == false) || (queued->isLastPiece == true));
+		
+		if (merge == true)
+		{
+			DecodeJob *first = previous->get();
+			
+			first->mergedLogIds.push_back(queued->logId);
+			first->isLastPiece = queued->isLastPiece;
+			
+			m_queue.erase(it);
+			return true;
+		}
+		
+		queued->dropped = true;
+		std::vector<int16_t>().swap(queued->samples);
+		
+		return true;
+	}
+	
+	return false;
+}
+
+//////////////////////////////////////////////
+//
+// greedy, no temperature fallback and an encoder context sized to the audio,
+// with a draft model only the draft is used (see useDraft)
+//
+//////////////////////////////////////////////
+void InferenceScheduler::degrade(DecodeJob *job)
+{
+	if (job->degraded == true)
+	{
+		return;
+	}
+	
+	job->degraded = true;
+	
+	job->wparams.strategy              = WHISPER_SAMPLING_GREEDY;
+	job->wparams.greedy.best_of        = 1;
+	job->wparams.beam_search.beam_size = 1;
+	job->wparams.temperature_inc       = 0.0f;
+	job->adaptiveAudioCtx              = true;
+	
+	Metrics::getInstance().utterancesDegraded.inc();
+}
+
+//////////////////////////////////////////////
+//
+// with the reject policy, sessions starting while the queue is full are turned away
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::admitSession(void)
+{
+	return (m_overloadPolicy != OVERLOAD_REJECT) || (isOverloaded() == false);
+}
+
+//////////////////////////////////////////////
+//
+// called with the lock held after every change of the queue
+//
+//////////////////////////////////////////////
+void InferenceScheduler::queueChanged(void)
+{
+	size_t ownerPending, totalPending;
+	
+	countPending(nullptr, ownerPending, totalPending);
+	
+	bool overloaded = (totalPending >= m_maxPending);
+	
+	if (overloaded != m_overloaded.load(std::memory_order_relaxed))
+	{
+		if (overloaded == true)
+		{
+			LOG_WARNING << "InferenceScheduler overloaded, " << totalPending << " utterances waiting";
+		}
+		else
+		{
+			LOG_INFO << "InferenceScheduler no longer overloaded";
+		}
+		
+		m_overloaded.store(overloaded, std::memory_order_relaxed);
+		Metrics::getInstance().overloaded.set(overloaded ? 1 : 0);
+	}
+	
+	Metrics::getInstance().queueDepth.set(m_queue.size());
+}
+
+//////////////////////////////////////////////
+//
+// a listener waits for the end of the utterance plus its decode, so longer
+// audio gets a later deadline; a partial is superseded soon anyway and gets
+// only the fixed budget
+//
+//////////////////////////////////////////////
+void InferenceScheduler::setDeadline(DecodeJob *job)
+{
+	job->arrival  = std::chrono::steady_clock::now();
+	job->deadline = job->arrival + m_deadlineBase;
+	
+	if (job->isPartial == false)
+	{
+		job->deadline += (m_deadlinePerAudioSecond * (long long) job->samples.size()) / WHISPER_SAMPLE_RATE;
+	}
+}
+
+//////////////////////////////////////////////
+//
+// should "job" run before "best"? both are complete utterances
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::isPreferred(DecodeJob *job, DecodeJob *best, std::chrono::steady_clock::time_point now)
+{
+	if (m_schedulePolicy == SCHEDULE_FIFO)
+	{
+		return (job->arrival < best->arrival);
+	}
+	
+	if (m_schedulePolicy == SCHEDULE_SJF)
+	{
+		// overdue jobs first so that long utterances don't starve
+		bool jobLate  = (job->deadline <= now);
+		bool bestLate = (best->deadline <= now);
+		
+		if (jobLate != bestLate)
+		{
+			return jobLate;
+		}
+		
+		if (jobLate == false)
+		{
+			return (job->samples.size() < best->samples.size());
+		}
+	}
+	
+	return (job->deadline < best->deadline);
+}
+
+//////////////////////////////////////////////
+//
+// true the first time a recognizer is seen since m_seenOwners was cleared
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::markSeen(VoskRecognizer *owner)
+{
+	if (std::find(m_seenOwners.begin(), m_seenOwners.end(), owner) != m_seenOwners.end())
+	{
+		return false;
+	}
+	
+	m_seenOwners.push_back(owner);
+	return true;
+}
+
+//////////////////////////////////////////////
+//
+// the complete utterance preferred by the schedule policy among the oldest
+// waiting job of every recognizer that is not busy with another job, or the
+// partial job with the earliest deadline if there is none
+//
+// only the oldest job of a recognizer is a candidate, its results must stay in order
+//
+//////////////////////////////////////////////
+std::deque<std::unique_ptr<DecodeJob>>::iterator InferenceScheduler::findRunnable(void)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	auto best    = m_queue.end();
+	auto partial = m_queue.end();
+	
+	m_seenOwners.clear();
+	
+	for (auto it = m_queue.begin(); it != m_queue.end(); it++)
+	{
+		if ((markSeen((*it)->owner) == false) || (m_busy.count((*it)->owner) > 0))
+		{
+			continue;
+		}
+		
+		if ((*it)->isPartial == true)
+		{
+			if ((partial == m_queue.end()) || ((*it)->deadline < (*partial)->deadline))
+			{
+				partial = it;
+			}
+		}
+		else if ((best == m_queue.end()) || (isPreferred(it->get(), best->get(), now) == true))
+		{
+			best = it;
+		}
+	}
+	
+	return (best != m_queue.end()) ? best : partial;
+}
+
+//////////////////////////////////////////////
+//
+// can this job be packed into the same window as the batch started by "first"?
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::isBatchable(DecodeJob *job, DecodeJob *first, size_t packedSamples)
+{
+	// partial jobs carry their own prompt
+	if ((job->isPartial == true) || (first->isPartial == true))
+	{
+		return false;
+	}
+	
+	if ((job->dropped == true) || (first->dropped == true))
+	{
+		return false;
+	}
+	
+	if (job->samples.size() > maxBatchableSamples)
+	{
+		return false;
+	}
+	
+	// several models might be loaded, the batch is decoded by one of them
+	if ((job->ctx != first->ctx) || (job->draftCtx != first->draftCtx) || (useDraft(job) != useDraft(first)))
+	{
+		return false;
+	}
+	
+	if ((job->language != first->language) || (job->wparams.translate != first->wparams.translate))
+	{
+		return false;
+	}
+	
+	// the batch is decoded with the parameters of the first job, sessions may differ
+	if ((job->wparams.strategy != first->wparams.strategy) || (job->wparams.beam_search.beam_size != first->wparams.beam_search.beam_size) ||
+		(job->wparams.greedy.best_of != first->wparams.greedy.best_of) || (job->wparams.max_tokens != first->wparams.max_tokens) ||
+		(job->wparams.audio_ctx != first->wparams.audio_ctx) || (job->wparams.speed_up != first->wparams.speed_up) ||
+		(job->adaptiveAudioCtx != first->adaptiveAudioCtx) || (job->wparams.token_timestamps != first->wparams.token_timestamps) ||
+		(job->wparams.temperature_inc != first->wparams.temperature_inc))
+	{
+		return false;
+	}
+	
+	return ((packedSamples + job->samples.size() + batchGapSamples) <= samplesPerWindow);
+}
+
+//////////////////////////////////////////////
+//
+// takes the preferred runnable job and, if it is short, adds more short jobs
+// of other recognizers (waiting a little for them if the batch is not full
+// yet, but not beyond the deadline of the first job)
+//
+// only the oldest job of a recognizer may join, otherwise its results could
+// be delivered out of order; once the wait has timed out the queue is scanned
+// one last time, runnable jobs that can't join (long, partial, other model)
+// must not keep the worker looping
+//
+// all recognizers of the returned batch are marked busy
+//
+//////////////////////////////////////////////
+std::vector<std::unique_ptr<DecodeJob>> InferenceScheduler::collectBatch(std::unique_lock<std::mutex>& lock)
+{
+	std::vector<std::unique_ptr<DecodeJob>> batch;
+	size_t packedSamples;
+	
+	auto it = findRunnable();
+	batch.push_back(std::move(*it));
+	m_queue.erase(it);
+	m_busy.insert(batch[0]->owner);
+	
+	if ((m_maxBatchSize < 2) || (isBatchable(batch[0].get(), batch[0].get(), 0) == false))
+	{
+		return batch;
+	}
+	
+	packedSamples = batch[0]->samples.size() + batchGapSamples;
+	
+	std::chrono::steady_clock::time_point deadline = std::min(batch[0]->arrival + m_maxBatchWait, batch[0]->deadline);
+	bool timedOut = false;
+	
+	while (batch.size() < m_maxBatchSize)
+	{
+		m_seenOwners.clear();
+		
+		for (auto qit = m_queue.begin(); (qit != m_queue.end()) && (batch.size() < m_maxBatchSize); )
+		{
+			if ((markSeen((*qit)->owner) == true) && (m_busy.count((*qit)->owner) == 0) && (isBatchable(qit->get(), batch[0].get(), packedSamples) == true))
+			{
+				packedSamples += (*qit)->samples.size() + batchGapSamples;
+				m_busy.insert((*qit)->owner);
+				batch.push_back(std::move(*qit));
+				qit = m_queue.erase(qit);
+			}
+			else
+			{
+				qit++;
+			}
+		}
+		
+		if ((batch.size() >= m_maxBatchSize) || (m_shutdown == true) || (timedOut == true))
+		{
+			break;
+		}
+		
+		// after a timeout the queue is scanned once more for what arrived just before
+		// the deadline; a runnable job that can't join must not keep the batch waiting
+		timedOut = (m_jobAvailable.wait_until(lock, deadline) == std::cv_status::timeout);
+	}
+	
+	return batch;
+}
+
+//////////////////////////////////////////////
+void InferenceScheduler::workerLoop(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	while (true)
+	{
+		std::vector<std::unique_ptr<DecodeJob>> batch;
+		std::vector<VoskRecognizer*> owners;
+		
+		m_jobAvailable.wait(lock, [this] { return (m_shutdown == true) || (findRunnable() != m_queue.end()); });
+		
+		if (m_shutdown == true)
+		{
+			break;
+		}
+		
+		batch = collectBatch(lock);
+		
+		queueChanged();
+		
+		lock.unlock();
+		
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (auto& job : batch)
+		{
+			Metrics::getInstance().queueWaitSeconds.observe(std::chrono::duration<double>(start - job->arrival).count());
+		}
+		
+		if (batch.size() > 1)
+		{
+			runBatch(batch);
+		}
+		else if (batch[0]->dropped == true)
+		{
+			batch[0]->success = false;
+			batch[0]->results.clear();
+		}
+		else
+		{
+			runJob(batch[0].get());
+		}
+		
+		// deliver before the recognizers are marked idle so that cancel() can't free them meanwhile
+		for (auto& job : batch)
+		{
+			recordDelivery(job.get());
+			owners.push_back(job->owner);
+			job->owner->decodeFinished(std::move(job));
+		}
+		
+		lock.lock();
+		
+		for (VoskRecognizer *owner : owners)
+		{
+			m_busy.erase(owner);
+		}
+		
+		m_jobDone.notify_all();
+		
+		// more jobs of the same recognizers might be runnable now
+		m_jobAvailable.notify_all();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// decodes with the draft model if there is one and the job is suitable,
+// then with the main model unless the draft result is accepted
+//
+//////////////////////////////////////////////
+void InferenceScheduler::runJob(DecodeJob *job)
+{
+	if (useDraft(job) == true)
+	{
+		decodeJob(job, true);
+		
+		if (acceptDraft(job) == true)
+		{
+			return;
+		}
+	}
+	else if ((job->draftCtx != nullptr) && (job->isPartial == false))
+	{
+		Metrics::getInstance().draftBypassed.inc();
+	}
+	
+	decodeJob(job, false);
+}
+
+//////////////////////////////////////////////
+bool InferenceScheduler::useDraft(DecodeJob *job)
+{
+	if (job->draftCtx == nullptr)
+	{
+		return false;
+	}
+	
+	if ((job->isPartial == true) || (job->degraded == true) || (job->draftMaxSamples == 0))
+	{
+		return true;
+	}
+	
+	return (job->samples.size() < job->draftMaxSamples);
+}
+
+//////////////////////////////////////////////
+//
+// partial and degraded jobs keep the draft result as it is, complete ones
+// only if every segment with text is certain enough
+//
+// no text at all is accepted as well: that is mostly noise the VAD let
+// through, decoding it again with the main model would double its cost
+// (and rather invite hallucinations than find words)
+//
+//////////////////////////////////////////////
+bool InferenceScheduler::acceptDraft(DecodeJob *job)
+{
+	if ((job->isPartial == true) || (job->degraded == true))
+	{
+		return true;
+	}
+	
+	Metrics& metrics = Metrics::getInstance();
+	
+	float confidence = 1.0f;
+	bool hasText = false;
+	
+	for (auto& result : job->results)
+	{
+		if (result->text.find_first_not_of(" \t\r\n") == std::string::npos)
+		{
+			continue;
+		}
+		
+		hasText = true;
+		confidence = std::min(confidence, result->m_confidence);
+	}
+	
+	if ((job->success == true) && (hasText == false))
+	{
+		metrics.draftAccepted.inc();
+		return true;
+	}
+	
+	metrics.draftConfidence.observe(confidence);
+	
+	if ((job->success == true) && (confidence >= job->draftMinConfidence))
+	{
+		metrics.draftAccepted.inc();
+		return true;
+	}
+	
+	LOG_DEBUG << "Draft confidence " << confidence << ", decoding again with the main model, instance=" << job->owner->getInstanceId();
+	
+	metrics.draftRescored.inc();
+	return false;
+}
+
+//////////////////////////////////////////////
+void InferenceScheduler::decodeJob(DecodeJob *job, bool draft)
+{
+	struct whisper_context* ctx = (draft == true) ? job->draftCtx : job->ctx;
+	DecoderPool& decoders       = (draft == true) ? *job->draftDecoders : *job->decoders;
+	
+	job->wparams.language  = job->language.c_str();
+	job->wparams.n_threads = m_threadsPerDecode;
+	
+	job->wparams.prompt_tokens   = (job->promptTokens.size() > 0) ? job->promptTokens.data() : nullptr;
+	job->wparams.prompt_n_tokens = job->promptTokens.size();
+	
+	job->success = true;
+	job->results.clear();
+	
+	LOG_DEBUG << "Push " << ((job->isPartial == true) ? "partial " : "") << "audio to whisper" << ((draft == true) ? " (draft)" : "")
+		<< ", instance=" << job->owner->getInstanceId() << " size=" << job->samples.size();
+	
+	// every worker keeps its conversion buffer
+	static thread_local std::vector<float> pcmf32;
+	
+	pcmf32.resize(job->samples.size());
+	convertToFloat(job->samples, pcmf32.data());
+	
+	chooseAudioCtx(job, ctx, pcmf32.size());
+	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
+	// the state is only needed until the results are copied out of it
+	DecoderLease lease(decoders);
+	struct whisper_state* state = lease.get();
+	
+	int status = whisper_full_with_state(ctx, state, job->wparams, pcmf32.data(), pcmf32.size());
+	
+	recordDecode(start, pcmf32.size());
+	if (job->isPartial == true)
+	{
+		Metrics::getInstance().partialDecodes.inc();
+	}
+	
+	if (status != 0)
+	{
+		LOG_ERROR << "whisper_full(): failed to process audio";
+		Metrics::getInstance().decodeFailures.inc();
+		job->success = false;
+		return;
+	}
+	
+	const int n_segments = whisper_full_n_segments_from_state(state);
+	for (int i = 0; i < n_segments; ++i) {
+		const char * text = whisper_full_get_segment_text_from_state(state, i);
+
+		const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+		const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+
+		std::unique_ptr<RecognitionResult> newResult = std::make_unique<RecognitionResult>(const_cast<char*>(text), (unsigned int) t0 * msPerTimestamp,
+			(unsigned int) t1 * msPerTimestamp, segmentConfidence(ctx, state, i));
+		
+		if (job->wparams.token_timestamps == true)
+		{
+			addWords(newResult.get(), ctx, state, i, 0);
+		}
+		
+		job->results.push_back(std::move(newResult));
+	}
+}
+
+//////////////////////////////////////////////
+//
+// mean probability of the text tokens of a segment (timestamps and other
+// special tokens are left out), 0 for a segment without text tokens
+//
+//////////////////////////////////////////////
+float InferenceScheduler::segmentConfidence(struct whisper_context *ctx, struct whisper_state *state, int segment)
+{
+	whisper_token eot = whisper_token_eot(ctx);
+	int n_tokens = whisper_full_n_tokens_from_state(state, segment);
+	float sum = 0.0f;
+	int count = 0;
+	
+	for (int i = 0; i < n_tokens; i++)
+	{
+		whisper_token_data token = whisper_full_get_token_data_from_state(state, segment, i);
+		
+		if (token.id >= eot)
+		{
+			continue;
+		}
+		
+		sum += token.p;
+		count++;
+	}
+	
+	return (count > 0) ? (sum / count) : 0.0f;
+}
+
+//////////////////////////////////////////////
+//
+// words of a segment from its text tokens: a token starting with a space
+// begins a new word, the others (rest of a word, punctuation) are appended
+//
+// token times need wparams.token_timestamps, offset (in whisper timestamp
+// units) is the start of the utterance within a batch
+//
+//////////////////////////////////////////////
+void InferenceScheduler::addWords(RecognitionResult *result, struct whisper_context *ctx, struct whisper_state *state, int segment, int64_t offset)
+{
+	whisper_token eot = whisper_token_eot(ctx);
+	int n_tokens = whisper_full_n_tokens_from_state(state, segment);
+	
+	for (int i = 0; i < n_tokens; i++)
+	{
+		whisper_token_data token = whisper_full_get_token_data_from_state(state, segment, i);
+		
+		if (token.id >= eot)
+		{
+			continue;
+		}
+		
+		const char *text = whisper_full_get_token_text_from_state(ctx, state, segment, i);
+		int64_t t0 = std::max((int64_t) 0, token.t0 - offset);
+		int64_t t1 = std::max(t0, token.t1 - offset);
+		
+		if ((result->words.size() == 0) || (text[0] == ' '))
+		{
+			const char *word = (text[0] == ' ') ? (text + 1) : text;
+			
+			result->words.emplace_back(const_cast<char*>(word), (unsigned int) t0 * msPerTimestamp, (unsigned int) t1 * msPerTimestamp, token.p);
+		}
+		else
+		{
+			RecognitionResult& word = result->words.back();
+			
+			word.text         += text;
+			word.end           = std::chrono::milliseconds(t1 * msPerTimestamp);
+			word.m_confidence *= token.p;
+		}
+	}
+}
+
+//////////////////////////////////////////////
+void InferenceScheduler::recordDecode(std::chrono::steady_clock::time_point start, size_t nrSamples)
+{
+	Metrics& metrics = Metrics::getInstance();
+	
+	double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double audioSeconds  = (double) nrSamples / WHISPER_SAMPLE_RATE;
+	
+	metrics.decodes.inc();
+	metrics.decodeSeconds.observe(decodeSeconds);
+	metrics.decodeAudioSeconds.observe(audioSeconds);
+	
+	if (audioSeconds > 0.0)
+	{
+		metrics.realTimeFactor.observe(decodeSeconds / audioSeconds);
+	}
+}
+
+//////////////////////////////////////////////
+//
+// latency of complete utterances from submit to delivery, and how many missed their deadline
+//
+//////////////////////////////////////////////
+void InferenceScheduler::recordDelivery(DecodeJob *job)
+{
+	if ((job->isPartial == true) || (job->dropped == true))
+	{
+		return;
+	}
+	
+	Metrics& metrics = Metrics::getInstance();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	
+	metrics.utteranceLatencySeconds.observe(std::chrono::duration<double>(now - job->arrival).count());
+	
+	if (now > job->deadline)
+	{
+		metrics.deadlineMisses.inc();
+		
+		LOG_DEBUG << "Deadline missed by " << std::chrono::duration<double>(now - job->deadline).count()
+			<< " s, instance=" << job->owner->getInstanceId() << " size=" << job->samples.size();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// whisper always encodes a 30 second window (1500 encoder frames), for short
+// audio most of it is padding; in adaptive mode only the frames covering the
+// audio plus some padding are encoded, which cuts the encoder time roughly
+// in proportion but may cost some accuracy (the model was trained on full windows)
+//
+//////////////////////////////////////////////
+void InferenceScheduler::chooseAudioCtx(DecodeJob *job, struct whisper_context *ctx, size_t nrSamples)
+{
+	int maxCtx = whisper_model_n_audio_ctx(ctx);
+	
+	if (job->adaptiveAudioCtx == true)
+	{
+		size_t paddedSamples = nrSamples + ((size_t) job->audioCtxPaddingMs * WHISPER_SAMPLE_RATE) / 1000;
+		size_t minSamples    = ((size_t) job->audioCtxMinMs * WHISPER_SAMPLE_RATE) / 1000;
+		size_t frames        = (std::max(paddedSamples, minSamples) + samplesPerEncoderFrame - 1) / samplesPerEncoderFrame;
+		
+		job->wparams.audio_ctx = (int) std::min(frames, (size_t) maxCtx);
+	}
+	
+	Metrics::getInstance().decodeAudioCtx.observe((job->wparams.audio_ctx > 0) ? job->wparams.audio_ctx : maxCtx);
+}
+
+//////////////////////////////////////////////
+//
+// whisper wants floats in [-1, 1), the loop is vectorized by the compiler
+//
+//////////////////////////////////////////////
+void InferenceScheduler::convertToFloat(const std::vector<int16_t>& input, float *output)
+{
+	const float scale = 1.0f / 32768.0f;
+	const int16_t *in = input.data();
+	size_t length = input.size();
+	
+	for (size_t i = 0; i < length; i++)
+	{
+		output[i] = (float) in[i] * scale;
+	}
+}
+
+//////////////////////////////////////////////
+//
+// decodes all jobs of the batch in one whisper_full call
+//
+// every segment must fall into exactly one utterance (plus its trailing gap),
+// otherwise the batch is decoded job by job so that no text ends up in the
+// wrong session
+//
+// a batch decoded by the draft model is followed by the main model for each
+// utterance whose draft result is not accepted
+//
+//////////////////////////////////////////////
+void InferenceScheduler::runBatch(std::vector<std::unique_ptr<DecodeJob>>& batch)
+{
+	DecodeJob *first = batch[0].get();
+	bool draft = useDraft(first);
+	struct whisper_context* ctx = (draft == true) ? first->draftCtx : first->ctx;
+	static thread_local std::vector<float> packed;
+	std::vector<size_t> offsets;
+	bool segmentsValid = true;
+	
+	packed.clear();
+	
+	for (auto& job : batch)
+	{
+		offsets.push_back(packed.size());
+		packed.resize(packed.size() + job->samples.size());
+		convertToFloat(job->samples, packed.data() + offsets.back());
+		packed.insert(packed.end(), batchGapSamples, 0.0f);
+		
+		job->success = true;
+		job->results.clear();
+	}
+	offsets.push_back(packed.size());
+	
+	first->wparams.language  = first->language.c_str();
+	first->wparams.n_threads = m_threadsPerDecode;
+	
+	LOG_DEBUG << "Push batch of " << batch.size() << " utterances to whisper" << ((draft == true) ? " (draft)" : "") << ", size=" << packed.size();
+	
+	if ((draft == false) && (first->draftCtx != nullptr))
+	{
+		Metrics::getInstance().draftBypassed.inc(batch.size());
+	}
+	
+	chooseAudioCtx(first, ctx, packed.size());
+	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
+	// released before any job is decoded on its own, which leases a state again
+	{
+		DecoderLease lease((draft == true) ? *first->draftDecoders : *first->decoders);
+		struct whisper_state* state = lease.get();
+		
+		int status = whisper_full_with_state(ctx, state, first->wparams, packed.data(), packed.size());
+		
+		recordDecode(start, packed.size());
+		Metrics::getInstance().batchDecodes.inc();
+		
+		if (status != 0)
+		{
+			LOG_ERROR << "whisper_full(): failed to process batch";
+			Metrics::getInstance().decodeFailures.inc();
+			segmentsValid = false;
+		}
+		
+		const int n_segments = segmentsValid ? whisper_full_n_segments_from_state(state) : 0;
+		for (int i = 0; (i < n_segments) && (segmentsValid == true); ++i) {
+			const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+			const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+			
+			size_t s0 = t0 * samplesPerTimestamp;
+			size_t s1 = t1 * samplesPerTimestamp;
+			
+			// find the utterance this segment starts in
+			unsigned int k = 0;
+			while ((k < batch.size()) && (s0 >= offsets[k + 1]))
+			{
+				k++;
+			}
+			
+			if ((k >= batch.size()) || (s1 > offsets[k + 1]))
+			{
+				LOG_DEBUG << "Batch segment " << i << " crosses utterance boundary, decoding jobs one by one";
+				segmentsValid = false;
+				break;
+			}
+			
+			const char * text = whisper_full_get_segment_text_from_state(state, i);
+			
+			unsigned int offset = offsets[k] / samplesPerTimestamp;
+			std::unique_ptr<RecognitionResult> newResult = std::make_unique<RecognitionResult>(const_cast<char*>(text), (unsigned int) (t0 - offset) * msPerTimestamp,
+				(unsigned int) (t1 - offset) * msPerTimestamp, segmentConfidence(ctx, state, i));
+			
+			if (first->wparams.token_timestamps == true)
+			{
+				addWords(newResult.get(), ctx, state, i, offset);
+			}
+			
+			batch[k]->results.push_back(std::move(newResult));
+		}
+	}
+	
+	if (segmentsValid == false)
+	{
+		for (auto& job : batch)
+		{
+			runJob(job.get());
+		}
+		return;
+	}
+	
+	for (auto& job : batch)
+	{
+		if ((draft == true) && (acceptDraft(job.get()) == false))
+		{
+			decodeJob(job.get(), false);
+		}
+	}
+}
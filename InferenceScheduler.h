@@ -0,0 +1,215 @@
+#ifndef INFERENCE_SCHEDULER_H
+#define INFERENCE_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <DecoderPool.h>
+#include <RecognitionResult.h>
+
+#include "whisper.h"
+
+class VoskRecognizer;
+
+enum OverloadPolicy {OVERLOAD_DROP_OLDEST, OVERLOAD_DEGRADE, OVERLOAD_REJECT};
+enum SchedulePolicy {SCHEDULE_FIFO, SCHEDULE_EDF, SCHEDULE_SJF};
+
+//////////////////////////////////////////////
+//
+// one complete utterance waiting to be (or being) decoded
+//
+//////////////////////////////////////////////
+class DecodeJob
+{
+public:
+	VoskRecognizer*         owner;
+	struct whisper_context* ctx;
+	// a decoding state is leased from the model's pool while the job runs
+	DecoderPool*            decoders;
+	
+	// cascade (nullptr without a draft model): short utterances are decoded by the
+	// draft model first and only decoded again by ctx if its confidence is too low
+	struct whisper_context* draftCtx;
+	DecoderPool*            draftDecoders;
+	float                   draftMinConfidence;
+	// longer utterances go to ctx right away, 0 = no limit
+	size_t                  draftMaxSamples;
+	
+	whisper_full_params     wparams;
+	// wparams.language points into this string
+	std::string             language;
+	
+	// 16 bit audio, converted to float only right before decoding
+	std::vector<int16_t>    samples;
+	
+	// wparams.prompt_tokens points into this vector
+	std::vector<whisper_token> promptTokens;
+	
+	// encoder context sized to the audio instead of wparams.audio_ctx
+	bool                    adaptiveAudioCtx;
+	int                     audioCtxPaddingMs;
+	int                     audioCtxMinMs;
+	
+	// partial decode of an utterance that is still growing
+	bool                    isPartial;
+	unsigned long long      utteranceNr;
+	// partial: where its audio ends within the utterance (samples)
+	size_t                  partialEnd;
+	
+	// over-long utterances are decoded in pieces, the text is joined after the last one
+	bool                    isLastPiece;
+	
+	// audio logger entry belonging to this utterance
+	unsigned long long      logId;
+	
+	// where the audio starts in the session (16 kHz audio passed to the VAD)
+	unsigned long long      streamOffsetMs;
+	
+	// overload: dropped jobs are delivered without decoding, degraded ones decoded with cheaper settings
+	bool                    dropped;
+	bool                    degraded;
+	// dropped: audio log entries of the later utterances of its recognizer
+	// dropped together with it (one queue entry stands for all of them)
+	std::vector<unsigned long long> mergedLogIds;
+	
+	// when the job was handed to the scheduler and when its result should be delivered
+	std::chrono::steady_clock::time_point arrival;
+	std::chrono::steady_clock::time_point deadline;
+	
+	// filled by the scheduler
+	bool                    success;
+	std::vector<std::unique_ptr<RecognitionResult>> results;
+};
+
+//////////////////////////////////////////////
+//
+// process-wide queue of utterances from all recognizers, decoded by a fixed
+// pool of workers sized to the machine
+//
+// jobs of one recognizer are decoded one after another (results must stay
+// in order and a partial job must see the previous utterance's text)
+//
+// a partial (streaming) job is superseded by any newer job of its recognizer
+// and complete utterances are preferred over partial ones
+//
+// every job gets a deadline when it is submitted, a fixed budget plus some
+// time per second of audio; among the waiting complete utterances (only the
+// oldest one of each recognizer can run) the schedule policy picks the one
+// arrived first (fifo), the earliest deadline (edf) or the shortest audio,
+// overdue jobs first (sjf), so short fresh utterances of the current speaker
+// don't wait behind a long monologue
+//
+// optionally (batch_size > 1), short utterances of different recognizers that
+// wait at the same time are decoded as one batch: whisper always encodes a 30
+// second window, so the utterances are packed into one window (separated by
+// silence) and the resulting segments are handed back by their timestamps;
+// off by default, the timestamps are not reliable enough to be sure that no
+// text ends up in another session, a segment crossing an utterance boundary
+// makes the whole batch decode again job by job, the decoder's text context
+// carries over from one session's audio to the next within the window (so
+// one client's words condition another client's transcript; no_context only
+// resets it between calls) and every batchable utterance waits up to
+// batch_wait_ms for company
+//
+// with a draft model, partial results, degraded jobs and short utterances are
+// decoded by it; a complete utterance is decoded again by the main model if
+// the draft's confidence (mean probability of the text tokens of its least
+// certain segment) is too low (a draft without text is kept, that is mostly
+// noise), long utterances go to the main model directly
+//
+// when decoding falls behind, the complete utterances waiting per recognizer
+// and in total are limited; at a limit the overload policy either drops the
+// oldest waiting utterance, decodes with cheaper settings (dropping only at
+// twice the limit) or, like drop_oldest, drops and also turns away new sessions
+// until the queue is below its limit again
+//
+//////////////////////////////////////////////
+class InferenceScheduler
+{
+public:
+	static InferenceScheduler& getInstance(void);
+	
+	void submit(std::unique_ptr<DecodeJob> job);
+	void cancel(VoskRecognizer *owner);
+	void waitIdle(VoskRecognizer *owner);
+	
+	bool isOverloaded(void) { return m_overloaded.load(std::memory_order_relaxed); }
+	bool admitSession(void);
+	
+	unsigned int getNrWorkers(void) { return m_nrWorkers; }
+	unsigned int getThreadsPerDecode(void) { return m_threadsPerDecode; }
+	
+private:
+	InferenceScheduler(void);
+	~InferenceScheduler(void);
+	
+	void workerLoop(void);
+	bool hasPendingJobs(VoskRecognizer *owner);
+	void countPending(VoskRecognizer *owner, size_t& ownerPending, size_t& totalPending);
+	void admit(DecodeJob *job);
+	bool dropOldest(VoskRecognizer *owner);
+	static void degrade(DecodeJob *job);
+	void queueChanged(void);
+	void setDeadline(DecodeJob *job);
+	bool isPreferred(DecodeJob *job, DecodeJob *best, std::chrono::steady_clock::time_point now);
+	bool markSeen(VoskRecognizer *owner);
+	std::deque<std::unique_ptr<DecodeJob>>::iterator findRunnable(void);
+	bool isBatchable(DecodeJob *job, DecodeJob *first, size_t packedSamples);
+	std::vector<std::unique_ptr<DecodeJob>> collectBatch(std::unique_lock<std::mutex>& lock);
+	void runJob(DecodeJob *job);
+	void decodeJob(DecodeJob *job, bool draft);
+	static bool useDraft(DecodeJob *job);
+	static bool acceptDraft(DecodeJob *job);
+	static float segmentConfidence(struct whisper_context *ctx, struct whisper_state *state, int segment);
+	static void addWords(RecognitionResult *result, struct whisper_context *ctx, struct whisper_state *state, int segment, int64_t offset);
+	static void recordDecode(std::chrono::steady_clock::time_point start, size_t nrSamples);
+	static void recordDelivery(DecodeJob *job);
+	static void chooseAudioCtx(DecodeJob *job, struct whisper_context *ctx, size_t nrSamples);
+	static void convertToFloat(const std::vector<int16_t>& input, float *output);
+	void runBatch(std::vector<std::unique_ptr<DecodeJob>>& batch);
+	
+	unsigned int m_nrWorkers;
+	unsigned int m_threadsPerDecode;
+	
+	// batching limits
+	unsigned int m_maxBatchSize;
+	std::chrono::milliseconds m_maxBatchWait;
+	
+	// complete utterances waiting, per recognizer and in total
+	size_t         m_maxPendingPerSession;
+	size_t         m_maxPending;
+	OverloadPolicy m_overloadPolicy;
+	
+	// order of the waiting utterances, deadline = arrival + base + per second of audio
+	SchedulePolicy            m_schedulePolicy;
+	std::chrono::milliseconds m_deadlineBase;
+	std::chrono::milliseconds m_deadlinePerAudioSecond;
+	
+	// total limit reached, read without the lock by new and rejected sessions
+	std::atomic<bool> m_overloaded;
+	
+	std::mutex              m_mutex;
+	std::condition_variable m_jobAvailable;
+	std::condition_variable m_jobDone;
+	
+	std::deque<std::unique_ptr<DecodeJob>> m_queue;
+	
+	// recognizers with a job currently being decoded
+	std::set<VoskRecognizer*> m_busy;
+	
+	// recognizers already seen while scanning the queue, kept to reuse its memory
+	std::vector<VoskRecognizer*> m_seenOwners;
+	
+	std::vector<std::thread> m_workers;
+	bool m_shutdown;
+};
+
+#endif // INFERENCE_SCHEDULER_H
@@ -0,0 +1,282 @@
+#include <Log.h>
+
+#include <streambuf>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+// if stdout can't keep up, lines beyond this are dropped (and counted)
+static const size_t maxPendingBytes = 4 * 1024 * 1024;
+
+static const char levelLetters[] = { 'E', 'W', 'I', 'D', 'T' };
+
+std::atomic<int> Log::s_level(Log::levelFromEnvironment());
+
+//////////////////////////////////////////////
+//
+// collects one line at a time, the string keeps its capacity
+//
+//////////////////////////////////////////////
+class LogBuffer : public std::streambuf
+{
+public:
+	std::string text;
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		if (traits_type::eq_int_type(c, traits_type::eof()) == false)
+		{
+			text.push_back(traits_type::to_char_type(c));
+		}
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char *s, std::streamsize n) override
+	{
+		text.append(s, static_cast<size_t>(n));
+		return n;
+	}
+};
+
+//////////////////////////////////////////////
+//
+// per-thread formatting buffer, no locking and no allocation once warmed up
+//
+//////////////////////////////////////////////
+class ThreadLogBuffer
+{
+public:
+	ThreadLogBuffer(void) : stream(&buffer)
+	{
+		buffer.text.reserve(256);
+	}
+
+	LogBuffer    buffer;
+	std::ostream stream;
+};
+
+static thread_local ThreadLogBuffer threadLogBuffer;
+
+//////////////////////////////////////////////
+Log& Log::getInstance(void)
+{
+	static Log instance;
+	return instance;
+}
+
+//////////////////////////////////////////////
+Log::Log(void)
+{
+	m_maxPending      = maxPendingBytes;
+	m_dropped         = 0;
+	m_reportedDropped = 0;
+	m_shutdown        = false;
+
+	m_pending.reserve(64 * 1024);
+	m_writing.reserve(64 * 1024);
+
+	m_sink = std::thread(&Log::sinkLoop, this);
+}
+
+//////////////////////////////////////////////
+//
+// everything appended so far is still written
+//
+//////////////////////////////////////////////
+Log::~Log(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+
+	m_pendingFilled.notify_all();
+	m_sink.join();
+}
+
+//////////////////////////////////////////////
+int Log::levelFromEnvironment(void)
+{
+	const char *levelEnv = std::getenv("VOSK_LOG_LEVEL");
+
+	if (levelEnv == nullptr)
+	{
+		return LOG_LEVEL_INFO;
+	}
+
+	LogLevel level;
+	if (parseLevel(levelEnv, level) == false)
+	{
+		return LOG_LEVEL_INFO;
+	}
+
+	return level;
+}
+
+//////////////////////////////////////////////
+bool Log::parseLevel(const std::string& name, LogLevel& level)
+{
+	if (name == "error")        level = LOG_LEVEL_ERROR;
+	else if (name == "warning") level = LOG_LEVEL_WARNING;
+	else if (name == "info")    level = LOG_LEVEL_INFO;
+	else if (name == "debug")   level = LOG_LEVEL_DEBUG;
+	else if (name == "trace")   level = LOG_LEVEL_TRACE;
+	else return false;
+
+	return true;
+}
+
+//////////////////////////////////////////////
+//
+// copies one complete line, only the sink thread touches stdout
+//
+//////////////////////////////////////////////
+void Log::append(const char *data, size_t length)
+{
+	bool wasEmpty;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if ((m_pending.size() + length) > m_maxPending)
+		{
+			m_dropped++;
+			return;
+		}
+
+		wasEmpty = m_pending.empty();
+		m_pending.append(data, length);
+	}
+
+	// the sink only waits if there was nothing to write
+	if (wasEmpty == true)
+	{
+		m_pendingFilled.notify_one();
+	}
+}
+
+//////////////////////////////////////////////
+unsigned long long Log::getDroppedLines(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_dropped;
+}
+
+//////////////////////////////////////////////
+//
+// for errors the process can't continue after (also in release builds,
+// where assert() does nothing): writes everything logged so far, including
+// the error itself, and aborts
+//
+//////////////////////////////////////////////
+void Log::abortProcess(void)
+{
+	// a second thread failing meanwhile waits here until the process is gone
+	static std::mutex abortMutex;
+	abortMutex.lock();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+
+	m_pendingFilled.notify_all();
+	m_sink.join();
+
+	std::abort();
+}
+
+//////////////////////////////////////////////
+void Log::sinkLoop(void)
+{
+	while (true)
+	{
+		unsigned long long newlyDropped;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_pendingFilled.wait(lock, [this] { return ((m_pending.empty() == false) || (m_shutdown == true)); });
+
+			if ((m_pending.empty() == true) && (m_shutdown == true))
+			{
+				return;
+			}
+
+			m_writing.swap(m_pending);
+
+			newlyDropped      = m_dropped - m_reportedDropped;
+			m_reportedDropped = m_dropped;
+		}
+
+		if (newlyDropped > 0)
+		{
+			char note[64];
+			int noteLength = snprintf(note, sizeof(note), "(%llu log lines dropped)\n", newlyDropped);
+			m_writing.append(note, static_cast<size_t>(noteLength));
+		}
+
+		const char *data = m_writing.data();
+		size_t remaining = m_writing.size();
+
+		while (remaining > 0)
+		{
+			ssize_t written = ::write(STDOUT_FILENO, data, remaining);
+
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+
+			data      += written;
+			remaining -= static_cast<size_t>(written);
+		}
+
+		m_writing.clear();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// every line starts with the wall clock time and the level
+//
+//////////////////////////////////////////////
+LogLine::LogLine(LogLevel level) : m_stream(threadLogBuffer.stream)
+{
+	struct timeval tv;
+	struct tm tm;
+	char prefix[32];
+
+	gettimeofday(&tv, nullptr);
+	localtime_r(&tv.tv_sec, &tm);
+
+	int prefixLength = snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d %c ",
+		tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(tv.tv_usec / 1000), levelLetters[level]);
+
+	threadLogBuffer.buffer.text.assign(prefix, static_cast<size_t>(prefixLength));
+
+	// formatting flags of the previous line must not leak into this one
+	m_stream.flags(std::ios_base::dec | std::ios_base::skipws);
+	m_stream.precision(6);
+	m_stream.fill(' ');
+	m_stream.clear();
+}
+
+//////////////////////////////////////////////
+LogLine::~LogLine(void)
+{
+	std::string& text = threadLogBuffer.buffer.text;
+
+	text.push_back('\n');
+	Log::getInstance().append(text.data(), text.size());
+}
@@ -0,0 +1,91 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+enum LogLevel {LOG_LEVEL_ERROR, LOG_LEVEL_WARNING, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG, LOG_LEVEL_TRACE};
+
+//////////////////////////////////////////////
+//
+// leveled logging with an asynchronous sink
+//
+// lines are formatted into a per-thread buffer, then copied in one go into
+// the pending buffer of the sink thread which writes everything collected
+// so far with a single write() to stdout
+//
+// the level is checked before anything gets formatted, so disabled
+// levels cost one relaxed atomic load:
+//
+// LOG_DEBUG << "utterance " << nr << " queued";
+//
+// the level is taken from VOSK_LOG_LEVEL (error, warning, info, debug, trace),
+// default is info; VoskConfig applies log_level of the config file once loaded
+//
+//////////////////////////////////////////////
+class Log
+{
+public:
+	static Log& getInstance(void);
+
+	static bool isEnabled(LogLevel level) { return (static_cast<int>(level) <= s_level.load(std::memory_order_relaxed)); }
+	static void setLevel(LogLevel level)  { s_level.store(static_cast<int>(level), std::memory_order_relaxed); }
+	static bool parseLevel(const std::string& name, LogLevel& level);
+
+	void append(const char *data, size_t length);
+	unsigned long long getDroppedLines(void);
+	[[noreturn]] void abortProcess(void);
+
+private:
+	Log(void);
+	~Log(void);
+
+	void sinkLoop(void);
+	static int levelFromEnvironment(void);
+
+	static std::atomic<int> s_level;
+
+	std::mutex              m_mutex;
+	std::condition_variable m_pendingFilled;
+
+	// lines not yet written, swapped with the sink's own buffer (both keep their capacity)
+	std::string        m_pending;
+	std::string        m_writing;
+	size_t             m_maxPending;
+	unsigned long long m_dropped;
+	unsigned long long m_reportedDropped;
+
+	bool        m_shutdown;
+	std::thread m_sink;
+};
+
+//////////////////////////////////////////////
+//
+// one log line, formatted into the calling thread's buffer
+// and handed to the sink when it goes out of scope
+//
+//////////////////////////////////////////////
+class LogLine
+{
+public:
+	LogLine(LogLevel level);
+	~LogLine(void);
+	std::ostream& stream(void) { return m_stream; }
+
+private:
+	std::ostream& m_stream;
+};
+
+#define VOSK_LOG(level) if (Log::isEnabled(level) == false) {} else LogLine(level).stream()
+
+#define LOG_ERROR   VOSK_LOG(LOG_LEVEL_ERROR)
+#define LOG_WARNING VOSK_LOG(LOG_LEVEL_WARNING)
+#define LOG_INFO    VOSK_LOG(LOG_LEVEL_INFO)
+#define LOG_DEBUG   VOSK_LOG(LOG_LEVEL_DEBUG)
+#define LOG_TRACE   VOSK_LOG(LOG_LEVEL_TRACE)
+
+#endif // LOG_H
@@ -0,0 +1,292 @@
+#include <Metrics.h>
+#include <Log.h>
+#include <VoskConfig.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////
+static void appendNumber(std::string& out, const char *format, double value)
+{
+	char number[64];
+	int length = snprintf(number, sizeof(number), format, value);
+	out.append(number, static_cast<size_t>(length));
+}
+
+//////////////////////////////////////////////
+void Metric::renderHeader(std::string& out, const char *type) const
+{
+	out += "# HELP ";
+	out += m_name;
+	out += " ";
+	out += m_help;
+	out += "\n# TYPE ";
+	out += m_name;
+	out += " ";
+	out += type;
+	out += "\n";
+}
+
+//////////////////////////////////////////////
+void MetricCounter::render(std::string& out) const
+{
+	renderHeader(out, "counter");
+	out += m_name;
+	out += " ";
+	out += std::to_string(get());
+	out += "\n";
+}
+
+//////////////////////////////////////////////
+void MetricGauge::render(std::string& out) const
+{
+	renderHeader(out, "gauge");
+	out += m_name;
+	out += " ";
+	out += std::to_string(get());
+	out += "\n";
+}
+
+//////////////////////////////////////////////
+MetricHistogram::MetricHistogram(const char *name, const char *help, std::vector<double> bounds) :
+	Metric(name, help), m_bounds(bounds), m_buckets(bounds.size() + 1), m_count(0), m_sum(0.0)
+{
+	for (auto& bucket : m_buckets)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+//////////////////////////////////////////////
+void MetricHistogram::observe(double value)
+{
+	size_t i = 0;
+
+	while ((i < m_bounds.size()) && (value > m_bounds[i]))
+	{
+		i++;
+	}
+
+	m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+
+	double sum = m_sum.load(std::memory_order_relaxed);
+	while (m_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed) == false)
+	{
+	}
+}
+
+//////////////////////////////////////////////
+//
+// buckets are stored individually, Prometheus wants them cumulative
+//
+//////////////////////////////////////////////
+void MetricHistogram::render(std::string& out) const
+{
+	uint64_t cumulative = 0;
+
+	renderHeader(out, "histogram");
+
+	for (size_t i = 0; i < m_buckets.size(); i++)
+	{
+		cumulative += m_buckets[i].load(std::memory_order_relaxed);
+
+		out += m_name;
+		out += "_bucket{le=\"";
+		if (i < m_bounds.size())
+		{
+			appendNumber(out, "%g", m_bounds[i]);
+		}
+		else
+		{
+			out += "+Inf";
+		}
+		out += "\"} ";
+		out += std::to_string(cumulative);
+		out += "\n";
+	}
+
+	out += m_name;
+	out += "_sum ";
+	appendNumber(out, "%.6f", m_sum.load(std::memory_order_relaxed));
+	out += "\n";
+
+	out += m_name;
+	out += "_count ";
+	out += std::to_string(m_count.load(std::memory_order_relaxed));
+	out += "\n";
+}
+
+//////////////////////////////////////////////
+Metrics& Metrics::getInstance(void)
+{
+	static Metrics instance;
+	return instance;
+}
+
+//////////////////////////////////////////////
+Metrics::Metrics(void) :
+	recognizersAlive("vosk_recognizers_alive", "Recognizer instances currently alive"),
+	recognizersCreated("vosk_recognizers_created_total", "Recognizer instances created"),
+	audioPackets("vosk_audio_packets_total", "Audio packets passed to accept_waveform"),
+	audioBytes("vosk_audio_bytes_total", "Audio bytes passed to accept_waveform"),
+	acceptWaveformSeconds("vosk_accept_waveform_seconds", "Time spent in accept_waveform per packet",
+		{ 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1 }),
+	finalResultWaitSeconds("vosk_final_result_wait_seconds", "Time a final result waited until the server fetched it",
+		{ 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 5.0 }),
+	resampledSamples("vosk_resampled_samples_total", "16 kHz samples after resampling, every one of them is passed to the VAD"),
+	vadFrames("vosk_vad_frames_total", "10 ms frames classified by the VAD"),
+	vadActiveFrames("vosk_vad_active_frames_total", "10 ms frames classified as speech"),
+	vadGatedFrames("vosk_vad_gated_frames_total", "10 ms frames taken as silence by the energy gate, without running the VAD"),
+	utterances("vosk_utterances_total", "Complete utterances handed over for decoding"),
+	utterancesDiscarded("vosk_utterances_discarded_total", "Utterances with too little speech, not decoded"),
+	utteranceSplits("vosk_utterance_splits_total", "Over-long utterances split into pieces"),
+	queueDepth("vosk_decode_queue_depth", "Jobs waiting in the decode queue"),
+	overloaded("vosk_overloaded", "1 while the decode queue is at its limit"),
+	utterancesDropped("vosk_utterances_dropped_total", "Waiting utterances dropped because of overload"),
+	utterancesDegraded("vosk_utterances_degraded_total", "Utterances decoded with cheaper settings because of overload"),
+	sessionsRejected("vosk_sessions_rejected_total", "Sessions turned away because of overload"),
+	decoderStates("vosk_decoder_states", "whisper decoding states allocated in the pools"),
+	decoderStatesBusy("vosk_decoder_states_busy", "whisper decoding states leased by a running decode"),
+	queueWaitSeconds("vosk_decode_queue_wait_seconds", "Time between submitting a job and the start of its decode",
+		{ 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0 }),
+	utteranceLatencySeconds("vosk_utterance_latency_seconds", "Time between submitting a complete utterance and the delivery of its result",
+		{ 0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0, 30.0 }),
+	deadlineMisses("vosk_deadline_misses_total", "Complete utterances delivered after their deadline"),
+	decodes("vosk_decodes_total", "whisper_full calls"),
+	partialDecodes("vosk_partial_decodes_total", "whisper_full calls for partial results"),
+	batchDecodes("vosk_batch_decodes_total", "whisper_full calls decoding a batch of utterances"),
+	decodeFailures("vosk_decode_failures_total", "Failed whisper_full calls"),
+	decodeSeconds("vosk_decode_seconds", "Duration of whisper_full",
+		{ 0.05, 0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0, 30.0 }),
+	decodeAudioSeconds("vosk_decode_audio_seconds", "Audio passed to whisper_full",
+		{ 0.5, 1.0, 2.0, 5.0, 10.0, 15.0, 20.0, 30.0 }),
+	realTimeFactor("vosk_decode_real_time_factor", "Decode duration divided by audio duration",
+		{ 0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1.0, 1.5, 2.0, 5.0 }),
+	decodeAudioCtx("vosk_decode_audio_ctx", "Encoder frames (20 ms each) per whisper_full call",
+		{ 150, 250, 375, 500, 750, 1000, 1250, 1500 }),
+	draftAccepted("vosk_draft_accepted_total", "Complete utterances whose draft model result was confident enough"),
+	draftRescored("vosk_draft_rescored_total", "Complete utterances decoded again by the main model because the draft was unsure"),
+	draftBypassed("vosk_draft_bypassed_total", "Long utterances decoded by the main model without a draft"),
+	draftConfidence("vosk_draft_confidence", "Confidence of the least certain segment of a draft result",
+		{ 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9 }),
+	audioLogDropped("vosk_audio_log_dropped_total", "Utterances not logged because the log writer queue was full")
+{
+	m_metrics = {
+		&recognizersAlive, &recognizersCreated,
+		&audioPackets, &audioBytes, &acceptWaveformSeconds, &finalResultWaitSeconds,
+		&resampledSamples, &vadFrames, &vadActiveFrames, &vadGatedFrames,
+		&utterances, &utterancesDiscarded, &utteranceSplits,
+		&queueDepth, &overloaded, &utterancesDropped, &utterancesDegraded, &sessionsRejected,
+		&decoderStates, &decoderStatesBusy, &queueWaitSeconds,
+		&utteranceLatencySeconds, &deadlineMisses, &decodes, &partialDecodes, &batchDecodes, &decodeFailures,
+		&decodeSeconds, &decodeAudioSeconds, &realTimeFactor, &decodeAudioCtx,
+		&draftAccepted, &draftRescored, &draftBypassed, &draftConfidence,
+		&audioLogDropped
+	};
+
+	m_shutdown = false;
+
+	VoskConfig& config = VoskConfig::getInstance();
+
+	m_dumpPath     = config.getString("metrics_file", "");
+	m_dumpInterval = std::chrono::seconds(std::max(1, config.getInt("metrics_interval", 10)));
+
+	if (m_dumpPath.size() > 0)
+	{
+		// the log sink has to outlive the dump thread
+		Log::getInstance();
+
+		LOG_INFO << "Metrics, writing " << m_dumpPath << " every " << m_dumpInterval.count() << " s";
+
+		m_dumper = std::thread(&Metrics::dumpLoop, this);
+	}
+}
+
+//////////////////////////////////////////////
+Metrics::~Metrics(void)
+{
+	if (m_dumper.joinable() == true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_shutdown = true;
+		}
+
+		m_shutdownSignal.notify_all();
+		m_dumper.join();
+	}
+}
+
+//////////////////////////////////////////////
+std::string Metrics::render(void)
+{
+	std::string out;
+
+	for (const Metric *metric : m_metrics)
+	{
+		metric->render(out);
+	}
+
+	return out;
+}
+
+//////////////////////////////////////////////
+void Metrics::dumpLoop(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (m_shutdown == false)
+	{
+		m_shutdownSignal.wait_for(lock, m_dumpInterval, [this] { return m_shutdown; });
+
+		lock.unlock();
+		dump();
+		lock.lock();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// written to a temporary file first, readers never see a half written file
+//
+//////////////////////////////////////////////
+void Metrics::dump(void)
+{
+	std::string text = render();
+	std::string tmpPath = m_dumpPath + ".tmp";
+
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		LOG_ERROR << "Error opening " << tmpPath << " for writing!";
+		return;
+	}
+
+	const char *data = text.data();
+	size_t remaining = text.size();
+	bool success = true;
+
+	while (remaining > 0)
+	{
+		ssize_t written = ::write(fd, data, remaining);
+		if (written <= 0)
+		{
+			success = false;
+			break;
+		}
+		data      += written;
+		remaining -= static_cast<size_t>(written);
+	}
+
+	::close(fd);
+
+	if ((success == false) || (::rename(tmpPath.c_str(), m_dumpPath.c_str()) != 0))
+	{
+		LOG_ERROR << "Error writing metrics to " << m_dumpPath;
+	}
+}
@@ -0,0 +1,162 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////
+//
+// base of all metrics, renders itself in the Prometheus text format
+//
+//////////////////////////////////////////////
+class Metric
+{
+public:
+	Metric(const char *name, const char *help) : m_name(name), m_help(help) {}
+	virtual ~Metric(void) {}
+	virtual void render(std::string& out) const = 0;
+
+protected:
+	const char *m_name;
+	const char *m_help;
+
+	void renderHeader(std::string& out, const char *type) const;
+};
+
+//////////////////////////////////////////////
+class MetricCounter : public Metric
+{
+public:
+	MetricCounter(const char *name, const char *help) : Metric(name, help), m_value(0) {}
+	void inc(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get(void) const { return m_value.load(std::memory_order_relaxed); }
+	void render(std::string& out) const override;
+
+private:
+	std::atomic<uint64_t> m_value;
+};
+
+//////////////////////////////////////////////
+class MetricGauge : public Metric
+{
+public:
+	MetricGauge(const char *name, const char *help) : Metric(name, help), m_value(0) {}
+	void add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+	void set(int64_t n) { m_value.store(n, std::memory_order_relaxed); }
+	int64_t get(void) const { return m_value.load(std::memory_order_relaxed); }
+	void render(std::string& out) const override;
+
+private:
+	std::atomic<int64_t> m_value;
+};
+
+//////////////////////////////////////////////
+//
+// fixed buckets given by their upper bounds, every observation is a few
+// relaxed atomic increments
+//
+//////////////////////////////////////////////
+class MetricHistogram : public Metric
+{
+public:
+	MetricHistogram(const char *name, const char *help, std::vector<double> bounds);
+	void observe(double value);
+	uint64_t getCount(void) const { return m_count.load(std::memory_order_relaxed); }
+	double getSum(void) const { return m_sum.load(std::memory_order_relaxed); }
+	void render(std::string& out) const override;
+
+private:
+	std::vector<double> m_bounds;
+	// one more bucket than bounds for +Inf
+	std::vector<std::atomic<uint64_t>> m_buckets;
+	std::atomic<uint64_t> m_count;
+	std::atomic<double>   m_sum;
+};
+
+//////////////////////////////////////////////
+//
+// all metrics of the process
+//
+// if metrics_file is configured, the metrics are written to that file every
+// metrics_interval seconds (default 10), replaced atomically so that
+// e.g. the textfile collector of the node exporter can pick them up
+//
+//////////////////////////////////////////////
+class Metrics
+{
+public:
+	static Metrics& getInstance(void);
+
+	std::string render(void);
+
+	// sessions
+	MetricGauge     recognizersAlive;
+	MetricCounter   recognizersCreated;
+
+	// API calls
+	MetricCounter   audioPackets;
+	MetricCounter   audioBytes;
+	MetricHistogram acceptWaveformSeconds;
+	MetricHistogram finalResultWaitSeconds;
+
+	// VAD
+	MetricCounter   resampledSamples;
+	MetricCounter   vadFrames;
+	MetricCounter   vadActiveFrames;
+	MetricCounter   vadGatedFrames;
+	MetricCounter   utterances;
+	MetricCounter   utterancesDiscarded;
+	MetricCounter   utteranceSplits;
+
+	// decoding
+	MetricGauge     queueDepth;
+	MetricGauge     overloaded;
+	MetricCounter   utterancesDropped;
+	MetricCounter   utterancesDegraded;
+	MetricCounter   sessionsRejected;
+	MetricGauge     decoderStates;
+	MetricGauge     decoderStatesBusy;
+	MetricHistogram queueWaitSeconds;
+	MetricHistogram utteranceLatencySeconds;
+	MetricCounter   deadlineMisses;
+	MetricCounter   decodes;
+	MetricCounter   partialDecodes;
+	MetricCounter   batchDecodes;
+	MetricCounter   decodeFailures;
+	MetricHistogram decodeSeconds;
+	MetricHistogram decodeAudioSeconds;
+	MetricHistogram realTimeFactor;
+	MetricHistogram decodeAudioCtx;
+	MetricCounter   draftAccepted;
+	MetricCounter   draftRescored;
+	MetricCounter   draftBypassed;
+	MetricHistogram draftConfidence;
+
+	// audio logging
+	MetricCounter   audioLogDropped;
+
+private:
+	Metrics(void);
+	~Metrics(void);
+
+	void dumpLoop(void);
+	void dump(void);
+
+	std::vector<const Metric*> m_metrics;
+
+	std::string m_dumpPath;
+	std::chrono::seconds m_dumpInterval;
+
+	std::mutex              m_mutex;
+	std::condition_variable m_shutdownSignal;
+	bool                    m_shutdown;
+	std::thread             m_dumper;
+};
+
+#endif // METRICS_H
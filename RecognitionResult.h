@@ -1,9 +1,19 @@
 #ifndef RECOGNITION_RESULT_H
 #define RECOGNITION_RESULT_H
 
+#include <string>
 #include <vector>
 #include <chrono>
 
+//////////////////////////////////////////////
+//
+// one segment of decoded text, or one word of it
+//
+// times are relative to the start of the decoded audio until the recognizer
+// moves them to the session's timeline; the confidence of a segment is the
+// mean probability of its tokens, of a word the product
+//
+//////////////////////////////////////////////
 class RecognitionResult
 {
 public:
@@ -12,6 +22,9 @@ public:
 	std::chrono::milliseconds end;
 	float                     m_confidence;
 	
+	// only filled when word timestamps were requested
+	std::vector<RecognitionResult> words;
+	
 	RecognitionResult(char* word, unsigned int startTimeMs, unsigned int endTimeMs, float confidence) 
 	{
 		text               = word;
@@ -0,0 +1,150 @@
+
+#include <Resampler.h>
+
+#include <Log.h>
+#include <numeric>
+#include <algorithm>
+
+#include <cassert>
+#include <cmath>
+
+//////////////////////////////////////////////
+Resampler::Resampler(int inputRate, int outputRate)
+{
+	assert((inputRate > 0) && (outputRate > 0));
+	
+	m_inputRate  = inputRate;
+	m_outputRate = outputRate;
+	
+	int divisor = std::gcd(inputRate, outputRate);
+	
+	m_up   = outputRate / divisor;
+	m_down = inputRate  / divisor;
+	
+	designFilter();
+	
+	LOG_INFO << "Resampler " << m_inputRate << " Hz --> " << m_outputRate << " Hz, up " << m_up << " down " << m_down << ", " << m_tapsPerPhase << " taps per phase";
+	
+	reset();
+}
+
+//////////////////////////////////////////////
+void Resampler::reset(void)
+{
+	// start with silence in the filter
+	m_history.assign(m_tapsPerPhase - 1, 0.0f);
+	m_inputPos = m_tapsPerPhase - 1;
+	m_phase    = 0;
+}
+
+//////////////////////////////////////////////
+//
+// windowed sinc lowpass at the upsampled rate, cutoff slightly below the
+// nyquist frequency of the lower of both rates, split into m_up phases
+//
+//////////////////////////////////////////////
+void Resampler::designFilter(void)
+{
+	if (m_up == m_down)
+	{
+		// same rate, the newest sample passes through
+		m_tapsPerPhase = tapAlign;
+		m_coefficients.assign(tapAlign, 0.0f);
+		m_coefficients[tapAlign - 1] = 1.0f;
+		return;
+	}
+	
+	// downsampling needs a longer filter (relative to the input rate) for the same steepness
+	double       ratio  = std::max(1.0, (double) m_down / (double) m_up);
+	unsigned int taps   = 2 * (unsigned int) std::ceil(sincZeroCrossings * ratio);
+	
+	m_tapsPerPhase = ((taps + tapAlign - 1) / tapAlign) * tapAlign;
+	
+	unsigned int length = m_tapsPerPhase * m_up;
+	
+	// normalized to the upsampled rate
+	double cutoff = 0.45 / (double) std::max(m_up, m_down);
+	double center = (length - 1) / 2.0;
+	
+	std::vector<double> prototype(length);
+	
+	for (unsigned int n = 0; n < length; n++)
+	{
+		double x    = n - center;
+		double sinc = (x == 0.0) ? 1.0 : std::sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+		
+		// blackman window
+		double window = 0.42 - 0.5 * std::cos(2.0 * M_PI * n / (length - 1)) + 0.08 * std::cos(4.0 * M_PI * n / (length - 1));
+		
+		// gain of m_up compensates the zeros inserted by upsampling
+		prototype[n] = 2.0 * cutoff * sinc * window * m_up;
+	}
+	
+	m_coefficients.assign(length, 0.0f);
+	
+	for (unsigned int phase = 0; phase < m_up; phase++)
+	{
+		for (unsigned int tap = 0; tap < m_tapsPerPhase; tap++)
+		{
+			// reversed, so that the newest input sample is multiplied with the last coefficient
+			m_coefficients[phase * m_tapsPerPhase + (m_tapsPerPhase - 1 - tap)] = (float) prototype[tap * m_up + phase];
+		}
+	}
+}
+
+//////////////////////////////////////////////
+//
+// converts all input, output samples are appended to "output"
+//
+//////////////////////////////////////////////
+void Resampler::process(const int16_t *input, size_t inputLength, std::vector<int16_t>& output)
+{
+	size_t historyLength = m_history.size();
+	
+	m_history.resize(historyLength + inputLength);
+	
+	for (size_t i = 0; i < inputLength; i++)
+	{
+		m_history[historyLength + i] = (float) input[i];
+	}
+	
+	output.reserve(output.size() + ((inputLength * m_up) / m_down) + 1);
+	
+	// every output sample needs m_tapsPerPhase input samples ending at m_inputPos
+	while (m_inputPos < m_history.size())
+	{
+		const float *x = m_history.data() + m_inputPos + 1 - m_tapsPerPhase;
+		const float *c = m_coefficients.data() + m_phase * m_tapsPerPhase;
+		
+		float acc[tapAlign] = { 0.0f };
+		
+		// independent accumulators so that the compiler can vectorize the dot product
+		for (unsigned int tap = 0; tap < m_tapsPerPhase; tap += tapAlign)
+		{
+			for (unsigned int lane = 0; lane < tapAlign; lane++)
+			{
+				acc[lane] += c[tap + lane] * x[tap + lane];
+			}
+		}
+		
+		float sum = 0.0f;
+		for (unsigned int lane = 0; lane < tapAlign; lane++)
+		{
+			sum += acc[lane];
+		}
+		
+		sum = std::round(sum);
+		sum = std::min(32767.0f, std::max(-32768.0f, sum));
+		output.push_back((int16_t) sum);
+		
+		m_phase    += m_down;
+		m_inputPos += m_phase / m_up;
+		m_phase     = m_phase % m_up;
+	}
+	
+	// drop input that is no longer needed by the filter
+	size_t consumed = m_inputPos + 1 - m_tapsPerPhase;
+	
+	m_history.erase(m_history.begin(), m_history.begin() + consumed);
+	m_inputPos -= consumed;
+}
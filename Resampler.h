@@ -0,0 +1,52 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <vector>
+
+//////////////////////////////////////////////
+//
+// rational polyphase resampler (upsample by L, lowpass, downsample by M)
+//
+// supports any integer input rate, e.g. 8, 16, 22.05, 32, 44.1 or 48 kHz
+// to 16 kHz; input of any length is accepted, the filter history is kept
+// between calls
+//
+//////////////////////////////////////////////
+class Resampler
+{
+public:
+	Resampler(int inputRate, int outputRate);
+	void reset(void);
+	void process(const int16_t *input, size_t inputLength, std::vector<int16_t>& output);
+	
+private:
+	// filter taps per phase are padded to a multiple of this (SIMD width)
+	static const unsigned int tapAlign = 8;
+	
+	// zero crossings of the sinc on each side (at the lower of both rates)
+	static const unsigned int sincZeroCrossings = 8;
+	
+	int m_inputRate;
+	int m_outputRate;
+	
+	unsigned int m_up;
+	unsigned int m_down;
+	
+	// taps of every phase, stored reversed and contiguously: m_coefficients[phase * m_tapsPerPhase + tap]
+	unsigned int       m_tapsPerPhase;
+	std::vector<float> m_coefficients;
+	
+	// input samples still needed by the filter, plus the new input
+	std::vector<float> m_history;
+	
+	// input sample (index into m_history) and phase of the next output sample
+	size_t       m_inputPos;
+	unsigned int m_phase;
+	
+	void designFilter(void);
+};
+
+#endif // RESAMPLER_H
@@ -1,3 +1,5 @@
+#ifndef VAD_FRAME_H
+#define VAD_FRAME_H
 
 #include <cstddef>
 
@@ -8,6 +10,9 @@ class VADFrame
 {
 public:
 	short    samples[numberSamples];
-	float    fSamples[numberSamples];
 	VADState state;
+	// position in the stream, the first frame of a session is 0
+	unsigned long long number;
 };
+
+#endif // VAD_FRAME_H
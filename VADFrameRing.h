@@ -0,0 +1,87 @@
+#ifndef VAD_FRAME_RING_H
+#define VAD_FRAME_RING_H
+
+#include <cstddef>
+#include <vector>
+
+#include <cassert>
+
+#include <VADFrame.h>
+
+//////////////////////////////////////////////
+//
+// preallocated FIFO of VAD frames
+//
+// frames are filled in place and never allocated individually, the ring
+// only grows (doubling) if more frames are buffered than ever before
+//
+//////////////////////////////////////////////
+template<std::size_t numberSamples>
+class VADFrameRing
+{
+public:
+	VADFrameRing(std::size_t initialCapacity)
+	{
+		assert(initialCapacity > 0);
+		
+		frames.resize(initialCapacity);
+		head  = 0;
+		count = 0;
+	}
+	
+	std::size_t size(void) const { return count; }
+	
+	VADFrame<numberSamples>& operator[](std::size_t i)
+	{
+		assert(i < count);
+		return frames[(head + i) % frames.size()];
+	}
+	
+	// appends a frame and returns it to be filled by the caller
+	VADFrame<numberSamples>& pushBack(void)
+	{
+		if (count == frames.size())
+		{
+			grow();
+		}
+		
+		count++;
+		
+		return (*this)[count - 1];
+	}
+	
+	// a removed frame stays valid until the next pushBack()
+	void popFront(std::size_t n = 1)
+	{
+		assert(n <= count);
+		
+		head   = (head + n) % frames.size();
+		count -= n;
+	}
+	
+	void clear(void)
+	{
+		head  = 0;
+		count = 0;
+	}
+	
+private:
+	std::vector<VADFrame<numberSamples>> frames;
+	std::size_t head;
+	std::size_t count;
+	
+	void grow(void)
+	{
+		std::vector<VADFrame<numberSamples>> larger(frames.size() * 2);
+		
+		for (std::size_t i = 0; i < count; i++)
+		{
+			larger[i] = (*this)[i];
+		}
+		
+		frames.swap(larger);
+		head = 0;
+	}
+};
+
+#endif // VAD_FRAME_RING_H
@@ -1,13 +1,18 @@
 
 #include <VADWrapper.h>
-
-#include <iostream>
+#include <Log.h>
+#include <Metrics.h>
 
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
+// enough for typical packet sizes, the ring grows if needed
+static const std::size_t initialRingFrames = 64;
+
 //////////////////////////////////////////////
-VADWrapper::VADWrapper(int aggressiveness, size_t frequencyHz)
+VADWrapper::VADWrapper(int aggressiveness, size_t frequencyHz, unsigned int startFrames, unsigned int prerollFrames, unsigned int hangoverFrames,
+	bool energyGate, int energyGateDbfs) : chunks(initialRingFrames)
 {
 	int status;
 	
@@ -16,25 +21,42 @@ VADWrapper::VADWrapper(int aggressiveness, size_t frequencyHz)
 	status = WebRtcVad_Init(rtcVadInst);
 	if (status != 0)
 	{
-		std::cout << "WebRtcVad_Init not successful!" << std::endl;
+		LOG_ERROR << "WebRtcVad_Init not successful!";
 	}
 	
 	status = WebRtcVad_set_mode(rtcVadInst, aggressiveness);
 	if (status != 0)
 	{
-		std::cout << "WebRtcVad_set_mode not successful!" << std::endl;
+		LOG_ERROR << "WebRtcVad_set_mode not successful!";
 	}
 	
 	status = WebRtcVad_ValidRateAndFrameLength(frequencyHz, nrVADSamples);
 	if (status != 0)
 	{
-		std::cout << "Invalid combination of sample rate and number of samples!" << std::endl;	
+		LOG_ERROR << "Invalid combination of sample rate and number of samples!";	
 	}
 	
 	leftOverSampleSize = 0;
 	
+	prebufVal  = startFrames;
+	prerollVal = prerollFrames;
+	postbufVal = hangoverFrames;
+	
+	// RMS level relative to full scale --> sum of squares of one frame
+	gateEnergy = 0;
+	if (energyGate == true)
+	{
+		double rms = 32768.0 * std::pow(10.0, energyGateDbfs / 20.0);
+		gateEnergy = (int64_t) (rms * rms * nrVADSamples);
+	}
+	
 	state = VADWrapperState::IDLE;
 	utteranceCurr  = -1;
+	startScanned   = 0;
+	startScore     = 0;
+	silentFrames   = 0;
+	utteranceSpeechFrames = 0;
+	nextFrameNr    = 0;
 }
 
 //////////////////////////////////////////////
@@ -47,84 +69,97 @@ VADWrapper::~VADWrapper(void)
 
 //////////////////////////////////////////////
 //
-// process all data provided, plus leftover from previous call
-// all data is VAD analyzed and stored in the "chunks" vector (leftover data is kept)
+// process all data provided (typically one packet), plus leftover from the previous call
+// all data is VAD analyzed and stored in the "chunks" ring, less than one frame is kept as leftover
 //
 //////////////////////////////////////////////
 int VADWrapper::process(int samplingFrequency, const int16_t* audio_frame, size_t frame_length)
 {
 	int result, retVal;
 	size_t frame_ptr;
+	uint64_t nrFrames, nrActiveFrames, nrGatedFrames;
 	
 	retVal = 0;
 	frame_ptr = 0;
+	nrFrames = 0;
+	nrActiveFrames = 0;
+	nrGatedFrames = 0;
 	
-	// frames to analyze should always have minimum length
-	if (frame_length < nrVADSamples)
+	// per-frame results are only collected if they are going to be logged
+	bool traceFrames = Log::isEnabled(LOG_LEVEL_TRACE);
+	if (traceFrames == true)
 	{
-		std::cout << "Got " << frame_length << " samples but expected at least " << nrVADSamples << std::endl;
-		assert(frame_length > nrVADSamples);
+		frameTrace.clear();
 	}
 	
-	while ((frame_length - frame_ptr) >= nrVADSamples)
+	// every frame starts with the leftover of the previous call (if any)
+	while ((frame_length - frame_ptr) >= (nrVADSamples - leftOverSampleSize))
 	{
-		std::unique_ptr<VADFrame<nrVADSamples>> chunk = std::make_unique<VADFrame<nrVADSamples>>();
-
-		// check and prepend leftover data
-		if (leftOverSampleSize > 0)
+		VADFrame<nrVADSamples>& chunk = chunks.pushBack();
+		size_t needed = nrVADSamples - leftOverSampleSize;
+		
+		memcpy(chunk.samples, leftOverSamples, leftOverSampleSize * sizeof(short));
+		memcpy(chunk.samples + leftOverSampleSize, audio_frame + frame_ptr, needed * sizeof(short));
+		
+		frame_ptr += needed;
+		leftOverSampleSize = 0;
+		
+		// (near) digital silence can't be speech, no need to ask the VAD
+		bool gated = false;
+		if (gateEnergy > 0)
 		{
-			assert(leftOverSampleSize < nrVADSamples);
-			
-			memcpy(chunk->samples, leftOverSamples, leftOverSampleSize);
-			memcpy(chunk->samples + leftOverSampleSize, audio_frame + frame_ptr, sizeof(chunk->samples) - leftOverSampleSize);
-			
-			frame_ptr += nrVADSamples - leftOverSampleSize;
-			leftOverSampleSize = 0;
+			int64_t energy = 0;
+			for (short sample : chunk.samples)
+			{
+				energy += (int32_t) sample * sample;
+			}
+			gated = (energy < gateEnergy);
+		}
+		
+		if (gated == true)
+		{
+			result = 0;
+			nrGatedFrames++;
 		}
 		else
 		{
-			memcpy(chunk->samples, audio_frame + frame_ptr, sizeof(chunk->samples));
-			frame_ptr += nrVADSamples;
+			// actual VAD processing
+			result = WebRtcVad_Process(rtcVadInst, samplingFrequency, chunk.samples, nrVADSamples);
 		}
 		
-		// actual VAD processing
-		result = WebRtcVad_Process(rtcVadInst, samplingFrequency, chunk->samples, nrVADSamples);
-		
-		// log every frame result
-		std::cout << result;
+		if (traceFrames == true)
+		{
+			frameTrace.push_back((gated == true) ? '-' : ((result == -1) ? 'E' : static_cast<char>('0' + result)));
+		}
 		
 		if (result == -1)
 		{
-			std::cout << "Error processing VAD data!" << std::endl;
+			LOG_ERROR << "Error processing VAD data!";
 			retVal = -1;
 		}
 		
 		// 1 == active, 0 == not active, -1 == error
-		chunk->state = (result == 1) ? VADState::ACTIVE : VADState::OFF;
+		chunk.state  = (result == 1) ? VADState::ACTIVE : VADState::OFF;
+		chunk.number = nextFrameNr++;
 		
-		if (result == 1)
-		{
-			// only when data will be used later, we need to convert to float for whisper
-			for (unsigned int tmp = 0; tmp < nrVADSamples; tmp++)
-			{
-				chunk->fSamples[tmp] = (float) (((double) chunk->samples[tmp]) / 32768.0); 
-			}
-		}
-		
-		chunks.push_back(std::move(chunk));
+		nrFrames++;
+		nrActiveFrames += (result == 1) ? 1 : 0;
 	}
 	
-	// finish logging VAD results
-	std::cout << std::endl;
+	LOG_TRACE << "VAD " << frameTrace;
+	
+	// once per call, not per frame
+	Metrics::getInstance().vadFrames.inc(nrFrames);
+	Metrics::getInstance().vadActiveFrames.inc(nrActiveFrames);
+	Metrics::getInstance().vadGatedFrames.inc(nrGatedFrames);
 	
-	// remember leftover data
+	// remember leftover data (appended, the call may not have completed a frame at all)
 	if (frame_ptr < frame_length)
 	{
-		assert((frame_length - frame_ptr) < nrVADSamples);
-		assert(leftOverSampleSize == 0);
+		assert((leftOverSampleSize + (frame_length - frame_ptr)) < nrVADSamples);
 		
-		leftOverSampleSize = frame_length - frame_ptr;
-		memcpy(leftOverSamples, audio_frame + frame_ptr, leftOverSampleSize);
+		memcpy(leftOverSamples + leftOverSampleSize, audio_frame + frame_ptr, (frame_length - frame_ptr) * sizeof(short));
+		leftOverSampleSize += frame_length - frame_ptr;
 	}
 	
 	return retVal;
@@ -132,8 +167,8 @@ int VADWrapper::process(int samplingFrequency, const int16_t* audio_frame, size_
 
 //////////////////////////////////////////////
 //
-// process the chunks vector
-// shrink until first utterance starts or minimum size of vector reached
+// advances the start/stop detection over the frames added since the last call,
+// every frame is looked at once
 //
 // returns true if there is no data to fetch for recognition
 //
@@ -184,155 +219,152 @@ unsigned int VADWrapper::getAvailableChunks(void)
 }
 
 //////////////////////////////////////////////
-std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> VADWrapper::getNextChunk(void)
+//
+// the returned frame stays valid until the next call of process()
+//
+//////////////////////////////////////////////
+const VADFrame<VADWrapper::nrVADSamples>& VADWrapper::getNextChunk(void)
 {
-	std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> chunk;
-	
 	assert(state != VADWrapperState::IDLE);
 	assert(chunks.size() > 0);
 	assert(utteranceCurr >= 0);
 	
 	utteranceCurr--;
 	
+	if (chunks[0].state == VADState::ACTIVE)
+	{
+		utteranceSpeechFrames++;
+	}
+	
 	// reset to idle state if a complete utterance was fetched successfully
 	if (state == VADWrapperState::COMPLETE)
 	{
 		if (utteranceCurr < 0)
 		{
-			std::cout << "VADWrapper::getNextChunk() resetting to IDLE after complete utterance was fetched" << std::endl;
+			LOG_DEBUG << "VADWrapper::getNextChunk() resetting to IDLE after complete utterance was fetched";
 			state = VADWrapperState::IDLE;
 			utteranceCurr = -1;
+			
+			// the frames after the end are searched for the next start
+			startScanned = 0;
+			startScore   = 0;
 		}
 	}
 	
-	// this moves the element to the local var but keeps an invalid (maybe null) entry in the deque
-	chunk = std::move(chunks.front());
+	const VADFrame<VADWrapper::nrVADSamples>& chunk = chunks[0];
+	
+	// the slot is only reused by the next process() call
+	chunks.popFront();
 	
-	// the invalid entry needs to be deleted
-	chunks.pop_front();
+	if (startScanned > 0)
+	{
+		startScanned--;
+	}
 	
-	// and the value itself be returned
 	return (chunk);
 }
 
+//////////////////////////////////////////////
+//
+// speech frames raise the score, silent frames lower it (not below 0),
+// an utterance starts when the score reaches prebufVal
+//
 //////////////////////////////////////////////
 bool VADWrapper::findUtteranceStart(void)
 {
-	unsigned int prebufCtr = 0;
-	unsigned int startToggleCtr = 0;
-	
 	assert(state == VADWrapperState::IDLE);
 	assert(utteranceCurr < 0);
 	
-	// find possible beginning of utterance 
-	for (unsigned int i = 0; i < chunks.size(); i++)
+	// only frames not seen by an earlier call
+	for (std::size_t i = startScanned; i < chunks.size(); i++)
 	{
-		if (chunks[i]->state == VADState::ACTIVE)
-		{
-			prebufCtr++;
-			startToggleCtr++;
-		}
-		else
+		if (chunks[i].state == VADState::ACTIVE)
 		{
-			if (prebufCtr > 0)
-			{
-				prebufCtr--;
-				startToggleCtr++;
-			}
+			startScore++;
 		}
-
-		if (startToggleCtr > 0)
+		else if (startScore > 0)
 		{
-			std::cout << "Utterance possible start at " << i << " with toggleCtr " << startToggleCtr << "." << std::endl;
+			startScore--;
 		}
 		
 		// did we find X active frames?
-		if (prebufCtr == prebufVal)
+		if (startScore == prebufVal)
 		{
-			// yes, chop off possible silence at beginning of vector
-			if (i > (2 * prebufVal))
+			// yes, chop off silence before the pre-roll
+			std::size_t keep = prebufVal + prerollVal;
+			std::size_t dropped = 0;
+			
+			if ((i + 1) > keep)
 			{
-				chunks.erase(chunks.begin(), chunks.begin() + (i - (2 * prebufVal)));	
+				dropped = (i + 1) - keep;
+				chunks.popFront(dropped);
 			}
 			
-			// remember until where we analyzed (for faster search for end)
-			utteranceCurr = chunks.size() - 1;
+			// the search for the end continues after the frame that triggered the start
+			utteranceCurr = (int) (i - dropped);
+			silentFrames  = 0;
+			utteranceSpeechFrames = 0;
+			startScanned  = 0;
+			startScore    = 0;
 			state = VADWrapperState::INCOMPLETE;
-			break;
+			
+			LOG_DEBUG << "VADWrapper::findUtteranceStart() triggered new utterance!";
+			
+			return true;
 		}
 	}
 	
-	// if nothing found, we can trim stored elements
-	if (state == VADWrapperState::IDLE)
+	// nothing found, keep enough frames for the pre-roll
+	std::size_t keep = prebufVal + prerollVal;
+	
+	if (chunks.size() > keep)
 	{
-		if (chunks.size() > (prebufVal * 2))
-		{
-			// std::cout << "Trimming silence. Have " << chunks.size() << " chunks, reduce to " << (prebufVal * 2) << std::endl; 
-			
-			// delete everything but the last 10 frames
-			chunks.erase(chunks.begin(), chunks.end() - (prebufVal * 2));
-
-			std::cout << "Chunks trimmed to " << chunks.size() << std::endl;
-			
-			assert(chunks.size() == (prebufVal * 2));
-		}
-		
-		return false;
+		chunks.popFront(chunks.size() - keep);
 	}
 	
-	std::cout << "VADWrapper::findUtteranceStart() triggered new utterance!" << std::endl;
+	startScanned = chunks.size();
 	
-	return true;
+	return false;
 }
 
+//////////////////////////////////////////////
+//
+// frames up to utteranceCurr were already searched (silentFrames holds the
+// silence at their end), only the new ones are looked at
+//
 //////////////////////////////////////////////
 void VADWrapper::findUtteranceStop(void)
 {
-	unsigned int postbufCtr = 0;
-	unsigned int searchStart = 0;
-	
 	assert(state == VADWrapperState::INCOMPLETE);
 	
-	if (utteranceCurr > 0)
-	{
-		searchStart = utteranceCurr;
-	}
-	
-	// std::cout << "VADWrapper::findUtteranceStop() searching from " << searchStart << " to " << chunks.size() << std::endl; 
-	
 	// find possible end of utterance 
-	for (unsigned int i = searchStart; i < chunks.size(); i++)
+	for (std::size_t i = (std::size_t) (utteranceCurr + 1); i < chunks.size(); i++)
 	{
-		if (chunks[i]->state == VADState::OFF)
+		if (chunks[i].state == VADState::OFF)
 		{
-			postbufCtr++;
+			silentFrames++;
 		}
 		else
 		{
-			postbufCtr = 0;	
+			silentFrames = 0;	
 		}
 		
-		// did we find X consecutive silent frames?
-		if (postbufCtr == postbufVal)
+		// did we find X consecutive silent frames (possibly over several calls)?
+		if (silentFrames == postbufVal)
 		{
-			std::cout << "Utterance stop found at " << i << "." << std::endl; 
+			LOG_DEBUG << "Utterance stop found at " << i << "."; 
 			
 			// utterance stops right here
-			utteranceCurr = i;
+			utteranceCurr = (int) i;
 			state = VADWrapperState::COMPLETE;
-			break;
+			
+			LOG_DEBUG << "VADWrapper::findUtteranceStop() complete, chunks = " << chunks.size() << " and end is at " << utteranceCurr; 
+			
+			return;
 		}
 	}
 
 	// not complete yet, so remember how far we analyzed
-	if (state == VADWrapperState::INCOMPLETE)
-	{
-		utteranceCurr = chunks.size() - 1;
-		std::cout << "VADWrapper::findUtteranceStop() still accumulating, chunks = " << chunks.size() << std::endl;
-	}
-	else
-	{
-		std::cout << "VADWrapper::findUtteranceStop() complete, chunks = " << chunks.size() << " and end is at " << utteranceCurr << std::endl; 
-	}
+	utteranceCurr = (int) chunks.size() - 1;
+	LOG_TRACE << "VADWrapper::findUtteranceStop() still accumulating, chunks = " << chunks.size();
 }
-
@@ -4,11 +4,11 @@
 
 #include <stdint.h>
 
-#include <deque>
-#include <memory>
 #include <cstddef>
+#include <string>
 
 #include <VADFrame.h>
+#include <VADFrameRing.h>
 
 extern "C" {
 #include "webrtc-audio-processing/webrtc/common_audio/vad/include/webrtc_vad.h"
@@ -16,34 +16,73 @@ extern "C" {
 
 enum VADWrapperState {IDLE, INCOMPLETE, COMPLETE};
 
+//////////////////////////////////////////////
+//
+// splits the audio into 10 ms frames, classifies them (speech or not) and
+// finds utterances in them
+//
+// an utterance starts after startFrames of speech, begins prerollFrames
+// before that (word onsets are often too quiet for the VAD) and ends after
+// hangoverFrames of silence, which stay part of it
+//
+// frames below the energy gate are taken as silence without running the
+// WebRTC VAD, which saves most of the CPU for muted or idle participants
+//
 //////////////////////////////////////////////
 class VADWrapper
 {
 public:
 	static const unsigned int nrVADSamples = 160;
 	
-	VADWrapper(int aggressiveness, size_t frequencyHz);
+	VADWrapper(int aggressiveness, size_t frequencyHz, unsigned int startFrames, unsigned int prerollFrames, unsigned int hangoverFrames,
+		bool energyGate, int energyGateDbfs);
 	~VADWrapper(void);
 	int process(int samplingFrequency, const int16_t* audio_frame, size_t frame_length);
 	bool analyze(void);
 	unsigned int getAvailableChunks(void);
 	VADWrapperState getUtteranceStatus(void) { return state; }
-	std::unique_ptr<VADFrame<nrVADSamples>> getNextChunk(void);
+	const VADFrame<nrVADSamples>& getNextChunk(void);
+	unsigned int getUtteranceSpeechFrames(void) { return utteranceSpeechFrames; }
 	
 private:
 	VadInst* rtcVadInst;
 	
-	std::deque<std::unique_ptr<VADFrame<nrVADSamples>>> chunks;
+	// frames are reused, no allocation per frame
+	VADFrameRing<nrVADSamples> chunks;
 	
+	// samples of an incomplete frame, completed by the next process() call
 	short       leftOverSamples[nrVADSamples];
 	std::size_t leftOverSampleSize;
 	
-	static const unsigned int prebufVal  = 5;
-	static const unsigned int postbufVal = 5;
+	// result of every frame of the last process() call, only filled at trace level
+	std::string frameTrace;
+	
+	// frames of speech needed to start an utterance, kept before its start and of silence to end it
+	unsigned int prebufVal;
+	unsigned int prerollVal;
+	unsigned int postbufVal;
+	
+	// frames with a lower sum of squared samples skip the VAD, 0: gate off
+	int64_t gateEnergy;
 	
 	VADWrapperState state;
+	
+	// last frame searched for the end of the utterance (or its last frame once complete)
 	int utteranceCurr;
 	
+	// idle: frames already scored by findUtteranceStart() and their score
+	std::size_t  startScanned;
+	unsigned int startScore;
+	
+	// silent frames at the end of the utterance so far, continued by every findUtteranceStop()
+	unsigned int silentFrames;
+	
+	// speech frames handed out for the current utterance
+	unsigned int utteranceSpeechFrames;
+	
+	// number of the next frame filled by process()
+	unsigned long long nextFrameNr;
+	
 	bool findUtteranceStart(void);
 	void findUtteranceStop(void);
 
@@ -0,0 +1,197 @@
+#include <VoskConfig.h>
+#include <Log.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+
+//////////////////////////////////////////////
+static std::string trim(const std::string& text)
+{
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == std::string::npos)
+	{
+		return std::string();
+	}
+
+	size_t last = text.find_last_not_of(" \t\r\n");
+	return text.substr(first, last - first + 1);
+}
+
+//////////////////////////////////////////////
+VoskConfig& VoskConfig::getInstance(void)
+{
+	static VoskConfig instance;
+	return instance;
+}
+
+//////////////////////////////////////////////
+VoskConfig::VoskConfig(void)
+{
+	const char *pathEnv = std::getenv("VOSK_CONFIG");
+
+	if (pathEnv != nullptr)
+	{
+		loadFile(pathEnv);
+	}
+
+	// the log level is known only now, everything logged before used VOSK_LOG_LEVEL
+	std::string level;
+	if (lookup("log_level", level) == true)
+	{
+		LogLevel logLevel;
+		if (Log::parseLevel(level, logLevel) == true)
+		{
+			Log::setLevel(logLevel);
+		}
+		else
+		{
+			LOG_WARNING << "VoskConfig, unknown log_level " << level;
+		}
+	}
+}
+
+//////////////////////////////////////////////
+void VoskConfig::loadFile(const std::string& path)
+{
+	std::ifstream in(path);
+	std::string line;
+	int lineNr = 0;
+
+	if (in.good() == false)
+	{
+		LOG_ERROR << "VoskConfig, cannot read " << path;
+		return;
+	}
+
+	LOG_INFO << "VoskConfig, reading " << path;
+
+	while (std::getline(in, line))
+	{
+		lineNr++;
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+		{
+			line.erase(comment);
+		}
+
+		line = trim(line);
+		if (line.size() == 0)
+		{
+			continue;
+		}
+
+		size_t separator = line.find('=');
+		if (separator == std::string::npos)
+		{
+			LOG_WARNING << "VoskConfig, ignoring line " << lineNr << " of " << path << ": " << line;
+			continue;
+		}
+
+		m_values[trim(line.substr(0, separator))] = trim(line.substr(separator + 1));
+	}
+}
+
+//////////////////////////////////////////////
+//
+// the environment wins over the file
+//
+//////////////////////////////////////////////
+bool VoskConfig::lookup(const std::string& key, std::string& value)
+{
+	std::string envName = "VOSK_" + key;
+	std::transform(envName.begin(), envName.end(), envName.begin(), [](unsigned char c) { return std::toupper(c); });
+
+	const char *envValue = std::getenv(envName.c_str());
+	if (envValue != nullptr)
+	{
+		value = envValue;
+		return true;
+	}
+
+	auto it = m_values.find(key);
+	if (it != m_values.end())
+	{
+		value = it->second;
+		return true;
+	}
+
+	return false;
+}
+
+//////////////////////////////////////////////
+std::string VoskConfig::getString(const std::string& key, const std::string& defaultValue)
+{
+	std::string value;
+	return (lookup(key, value) == true) ? value : defaultValue;
+}
+
+//////////////////////////////////////////////
+int VoskConfig::getInt(const std::string& key, int defaultValue)
+{
+	std::string value;
+
+	if (lookup(key, value) == false)
+	{
+		return defaultValue;
+	}
+
+	char *end;
+	long number = std::strtol(value.c_str(), &end, 10);
+
+	if ((value.size() == 0) || (*end != '\0'))
+	{
+		LOG_WARNING << "VoskConfig, " << key << " = " << value << " is not a number, using " << defaultValue;
+		return defaultValue;
+	}
+
+	return (int) number;
+}
+
+//////////////////////////////////////////////
+float VoskConfig::getFloat(const std::string& key, float defaultValue)
+{
+	std::string value;
+
+	if (lookup(key, value) == false)
+	{
+		return defaultValue;
+	}
+
+	char *end;
+	float number = std::strtof(value.c_str(), &end);
+
+	if ((value.size() == 0) || (*end != '\0'))
+	{
+		LOG_WARNING << "VoskConfig, " << key << " = " << value << " is not a number, using " << defaultValue;
+		return defaultValue;
+	}
+
+	return number;
+}
+
+//////////////////////////////////////////////
+bool VoskConfig::getBool(const std::string& key, bool defaultValue)
+{
+	std::string value;
+
+	if (lookup(key, value) == false)
+	{
+		return defaultValue;
+	}
+
+	if ((value == "1") || (value == "true") || (value == "yes") || (value == "on"))
+	{
+		return true;
+	}
+
+	if ((value == "0") || (value == "false") || (value == "no") || (value == "off"))
+	{
+		return false;
+	}
+
+	LOG_WARNING << "VoskConfig, " << key << " = " << value << " is not a boolean, using " << defaultValue;
+	return defaultValue;
+}
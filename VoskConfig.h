@@ -0,0 +1,38 @@
+#ifndef VOSK_CONFIG_H
+#define VOSK_CONFIG_H
+
+#include <map>
+#include <string>
+
+//////////////////////////////////////////////
+//
+// process-wide settings, read once
+//
+// values come from the file named by VOSK_CONFIG (lines of "key = value",
+// '#' starts a comment) and can be overridden by environment variables
+// named VOSK_<KEY>, e.g. "language = de" in the file or VOSK_LANGUAGE=de
+//
+// see vosk_whisper.conf for all keys and their defaults
+//
+//////////////////////////////////////////////
+class VoskConfig
+{
+public:
+	static VoskConfig& getInstance(void);
+
+	std::string getString(const std::string& key, const std::string& defaultValue);
+	int getInt(const std::string& key, int defaultValue);
+	float getFloat(const std::string& key, float defaultValue);
+	bool getBool(const std::string& key, bool defaultValue);
+
+private:
+	VoskConfig(void);
+
+	bool lookup(const std::string& key, std::string& value);
+	void loadFile(const std::string& path);
+
+	// only written by the constructor, so reading needs no lock
+	std::map<std::string, std::string> m_values;
+};
+
+#endif // VOSK_CONFIG_H
@@ -0,0 +1,305 @@
+
+#include <VoskModel.h>
+
+#include <InferenceScheduler.h>
+#include <Log.h>
+#include <VoskConfig.h>
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////
+VoskModel::VoskModel(int instanceId, const char *modelPath)
+{
+	m_instanceId = instanceId;
+	m_modelPath  = std::string(modelPath);
+	
+	// the creator (vosk_model_new) holds the first reference
+	m_refCount = 1;
+	
+	ctx = nullptr;
+	
+	m_draft = nullptr;
+}
+
+//////////////////////////////////////////////
+VoskModel::~VoskModel(void)
+{
+	LOG_INFO << "VoskModel, releasing whisper model of instance " << m_instanceId;
+	
+	if (m_draft != nullptr)
+	{
+		m_draft->release();
+	}
+	
+	// the states belong to the context
+	m_decoders.reset();
+	
+	if (ctx != nullptr)
+	{
+		whisper_free(ctx);
+		ctx = nullptr;
+	}
+}
+
+//////////////////////////////////////////////
+void VoskModel::acquire(void)
+{
+	m_refCount++;
+}
+
+//////////////////////////////////////////////
+//
+// drops one reference, the last one deletes the model
+//
+//////////////////////////////////////////////
+void VoskModel::release(void)
+{
+	int remaining = --m_refCount;
+	
+	assert(remaining >= 0);
+	
+	if (remaining == 0)
+	{
+		delete(this);
+	}
+}
+
+//////////////////////////////////////////////
+//
+// called by vosk_model_new, i.e. at server start before any session exists
+//
+// loading, warming up and locking are all optional, without preloading the
+// weights are loaded by the first recognizer as before
+//
+//////////////////////////////////////////////
+void VoskModel::preload(void)
+{
+	VoskConfig& config = VoskConfig::getInstance();
+	
+	if (config.getBool("model_preload", true) == false)
+	{
+		return;
+	}
+	
+	getContext();
+	
+	if (config.getBool("model_warmup", true) == true)
+	{
+		warmUp();
+	}
+	
+	if (m_draft != nullptr)
+	{
+		m_draft->getContext();
+		
+		if (config.getBool("model_warmup", true) == true)
+		{
+			m_draft->warmUp();
+		}
+	}
+	
+	// after the warm-up, so the buffers it allocated are locked as well
+	if (config.getBool("model_mlock", false) == true)
+	{
+		lockMemory();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// takes over the creator's reference of the draft model
+//
+//////////////////////////////////////////////
+void VoskModel::setDraft(VoskModel *draft)
+{
+	m_draft = draft;
+}
+
+//////////////////////////////////////////////
+//
+// the whisper weights are loaded by whoever needs them first,
+// all later callers get the same context
+//
+//////////////////////////////////////////////
+struct whisper_context* VoskModel::getContext(void)
+{
+	std::lock_guard<std::mutex> lock(m_loadMutex);
+	
+	if (ctx == nullptr)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		
+		ctx = loadContext();
+		
+		if (ctx == nullptr)
+		{
+			LOG_ERROR << "VoskModel, failed to load whisper model " << m_modelPath;
+			Log::getInstance().abortProcess();
+		}
+		
+		LOG_INFO << "VoskModel, loaded whisper model in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s";
+	}
+	
+	return ctx;
+}
+
+//////////////////////////////////////////////
+//
+// by default as many states as the scheduler runs decodes at the same time,
+// decoder_states can cap that to save memory (decodes then wait for a state)
+//
+//////////////////////////////////////////////
+DecoderPool& VoskModel::getDecoderPool(void)
+{
+	struct whisper_context* context = getContext();
+	
+	std::lock_guard<std::mutex> lock(m_loadMutex);
+	
+	if (m_decoders == nullptr)
+	{
+		int maxStates = VoskConfig::getInstance().getInt("decoder_states", 0);
+		
+		if (maxStates <= 0)
+		{
+			maxStates = (int) InferenceScheduler::getInstance().getNrWorkers();
+		}
+		
+		m_decoders = std::make_unique<DecoderPool>(context, (unsigned int) maxStates);
+	}
+	
+	return *m_decoders;
+}
+
+//////////////////////////////////////////////
+struct whisper_context* VoskModel::loadContext(void)
+{
+	if (VoskConfig::getInstance().getBool("model_mmap", false) == true)
+	{
+		struct whisper_context* mapped = loadContextMapped();
+		
+		if (mapped != nullptr)
+		{
+			return mapped;
+		}
+		
+		LOG_WARNING << "VoskModel, mapping " << m_modelPath << " failed, reading it instead";
+	}
+	
+	LOG_INFO << "VoskModel, loading whisper model " << m_modelPath;
+	
+	return whisper_init_from_file_no_state(m_modelPath.c_str());
+}
+
+//////////////////////////////////////////////
+//
+// whisper copies the tensors out of the buffer while loading, so the mapping
+// is only needed during whisper_init; it saves the read() copies through a
+// stdio buffer and lets the kernel read ahead the whole file
+//
+//////////////////////////////////////////////
+struct whisper_context* VoskModel::loadContextMapped(void)
+{
+	int fd = ::open(m_modelPath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_ERROR << "VoskModel, cannot open " << m_modelPath << ": " << strerror(errno);
+		return nullptr;
+	}
+	
+	struct stat fileStat;
+	if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size <= 0))
+	{
+		::close(fd);
+		return nullptr;
+	}
+	
+	size_t size = (size_t) fileStat.st_size;
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	
+	// the mapping keeps the file referenced
+	::close(fd);
+	
+	if (data == MAP_FAILED)
+	{
+		LOG_ERROR << "VoskModel, cannot map " << m_modelPath << ": " << strerror(errno);
+		return nullptr;
+	}
+	
+	madvise(data, size, MADV_SEQUENTIAL);
+	madvise(data, size, MADV_WILLNEED);
+	
+	LOG_INFO << "VoskModel, loading whisper model " << m_modelPath << " from a mapping of " << size << " bytes";
+	
+	struct whisper_context* mapped = whisper_init_from_buffer_no_state(data, size);
+	
+	munmap(data, size);
+	
+	return mapped;
+}
+
+//////////////////////////////////////////////
+//
+// one short decode of quiet noise, so the first real decode doesn't pay for
+// page faults on the weights, first-use allocations and cold caches
+//
+// the state used stays in the pool for the first real decode
+//
+//////////////////////////////////////////////
+void VoskModel::warmUp(void)
+{
+	DecoderLease lease(getDecoderPool());
+	
+	std::vector<float> samples(WHISPER_SAMPLE_RATE);
+	std::mt19937 rng(1);
+	std::normal_distribution<float> noise(0.0f, 0.01f);
+	
+	for (float& sample : samples)
+	{
+		sample = noise(rng);
+	}
+	
+	whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	
+	wparams.n_threads        = InferenceScheduler::getInstance().getThreadsPerDecode();
+	wparams.print_progress   = false;
+	wparams.print_special    = false;
+	wparams.print_realtime   = false;
+	wparams.print_timestamps = false;
+	wparams.language         = "en";
+	wparams.max_tokens       = 8;
+	wparams.temperature_inc  = 0.0f;
+	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
+	int status = whisper_full_with_state(getContext(), lease.get(), wparams, samples.data(), samples.size());
+	
+	LOG_INFO << "VoskModel, warm-up decode took " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+		<< " s, status=" << status;
+}
+
+//////////////////////////////////////////////
+//
+// keeps the weights from being swapped out, the server would stall on page faults
+// instead; needs CAP_IPC_LOCK or a big enough RLIMIT_MEMLOCK (docker run --ulimit memlock=-1)
+//
+//////////////////////////////////////////////
+void VoskModel::lockMemory(void)
+{
+	if (mlockall(MCL_CURRENT) != 0)
+	{
+		LOG_WARNING << "VoskModel, mlockall failed: " << strerror(errno) << ", model pages may be swapped out";
+		return;
+	}
+	
+	LOG_INFO << "VoskModel, memory locked";
+}
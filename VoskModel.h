@@ -0,0 +1,64 @@
+#ifndef VOSK_MODEL_H
+#define VOSK_MODEL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <DecoderPool.h>
+
+#include "whisper.h"
+
+//////////////////////////////////////////////
+//
+// one model instance is shared by all recognizers of the server
+//
+// the whisper weights are loaded once, the decoding states created from them
+// are pooled and leased per decode; the model is released when both the server
+// (vosk_model_free) and the last recognizer have dropped their reference
+//
+// vosk_model_new loads the weights right away and runs a warm-up decode
+// (model_preload, model_warmup), so the first session doesn't wait for it
+//
+// with draft_model configured, a second (smaller, faster) model is owned by
+// this one and used by the scheduler to decode first (see InferenceScheduler)
+//
+//////////////////////////////////////////////
+class VoskModel
+{
+public:
+	VoskModel(int instanceId, const char *modelPath);
+	int getInstanceId(void) { return m_instanceId; }
+	const std::string& getModelPath(void) { return m_modelPath; }
+	void acquire(void);
+	void release(void);
+	void preload(void);
+	void setDraft(VoskModel *draft);
+	VoskModel* getDraft(void) { return m_draft; }
+	struct whisper_context* getContext(void);
+	DecoderPool& getDecoderPool(void);
+	
+private:
+	~VoskModel(void);
+	
+	struct whisper_context* loadContext(void);
+	struct whisper_context* loadContextMapped(void);
+	void warmUp(void);
+	void lockMemory(void);
+	
+	int         m_instanceId;
+	std::string m_modelPath;
+	
+	std::atomic<int> m_refCount;
+	
+	// guards lazy loading of the shared context and the pool
+	std::mutex m_loadMutex;
+	struct whisper_context* ctx;
+	std::unique_ptr<DecoderPool> m_decoders;
+	
+	// cascade, nullptr without a draft model
+	VoskModel *m_draft;
+};
+
+#endif // VOSK_MODEL_H
@@ -1,5 +1,8 @@
 
 #include <VoskRecognizer.h>
+#include <Log.h>
+#include <Metrics.h>
+#include <VoskConfig.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,108 +10,285 @@
 #include <string.h>
 #include <dlfcn.h>
 
+#include <algorithm>
 #include <cassert>
 
 #include "common.h"
 
-int VoskRecognizer::voskRecognizerInstanceId = 1;
+std::atomic<int> VoskRecognizer::voskRecognizerInstanceId(1);
+
+// over-long utterances are split, but never into pieces shorter than this
+static const int32_t minMaxUtteranceMs = 1000;
+
+//////////////////////////////////////////////
+//
+// recognized text is put into JSON strings as is, so escape what would break them
+//
+//////////////////////////////////////////////
+static std::string jsonEscape(const std::string& text)
+{
+	std::string escaped;
+	
+	for (char c : text)
+	{
+		switch (c)
+		{
+			case '"':  escaped += "\\\""; break;
+			case '\\': escaped += "\\\\"; break;
+			case '\n': escaped += "\\n"; break;
+			case '\r': escaped += "\\r"; break;
+			case '\t': escaped += "\\t"; break;
+			default:
+				if ((unsigned char) c >= 0x20)
+				{
+					escaped += c;
+				}
+				break;
+		}
+	}
+	
+	return escaped;
+}
 
 //////////////////////////////////////////////
-VoskRecognizer::VoskRecognizer(int modelId, float sample_rate, const char *configPath)
+//
+// compiled in defaults, overridden by the configuration (read only once)
+//
+//////////////////////////////////////////////
+static const whisper_params& defaultParams(void)
 {
-	std::cout << "vosk_recognizer_new, instance=" << voskRecognizerInstanceId << " sample_rate=" << sample_rate << std::endl;
+	static const whisper_params params = [] {
+		VoskConfig& config = VoskConfig::getInstance();
+		whisper_params p;
+		
+		p.language         = config.getString("language",        p.language);
+		p.translate        = config.getBool("translate",         p.translate);
+		p.max_tokens       = config.getInt("max_tokens",         p.max_tokens);
+		p.audio_ctx        = config.getInt("audio_ctx",          p.audio_ctx);
+		p.audio_ctx_padding_ms = std::max(0, config.getInt("audio_ctx_padding_ms", p.audio_ctx_padding_ms));
+		p.audio_ctx_min_ms     = std::max(0, config.getInt("audio_ctx_min_ms",     p.audio_ctx_min_ms));
+		p.speed_up         = config.getBool("speed_up",          p.speed_up);
+		p.no_fallback      = config.getBool("no_fallback",       p.no_fallback);
+		p.beam_size        = config.getInt("beam_size",          p.beam_size);
+		p.best_of          = config.getInt("best_of",            p.best_of);
+		p.draft_max_ms     = std::max(0, config.getInt("draft_max_ms", p.draft_max_ms));
+		p.draft_min_confidence = config.getFloat("draft_min_confidence", p.draft_min_confidence);
+		p.step_ms          = config.getInt("step_ms",            p.step_ms);
+		p.length_ms        = config.getInt("length_ms",          p.length_ms);
+		p.max_utterance_ms = config.getInt("max_utterance_ms",   p.max_utterance_ms);
+		p.split_search_ms  = std::max(0, config.getInt("split_search_ms", p.split_search_ms));
+		
+		// shorter limits would decode a tiny piece for every VAD frame
+		int32_t minUtteranceMs = std::max(minMaxUtteranceMs, p.split_search_ms);
+		if (p.max_utterance_ms < minUtteranceMs)
+		{
+			LOG_WARNING << "max_utterance_ms " << p.max_utterance_ms << " too short, using " << minUtteranceMs;
+			p.max_utterance_ms = minUtteranceMs;
+		}
+		p.stream_partials  = config.getBool("stream_partials",   p.stream_partials);
+		p.words            = config.getBool("words",             p.words);
+		
+		std::string audioCtxMode = config.getString("audio_ctx_mode", "full");
+		p.adaptive_audio_ctx = (audioCtxMode == "adaptive");
+		if ((audioCtxMode != "adaptive") && (audioCtxMode != "full"))
+		{
+			LOG_WARNING << "Unknown audio_ctx_mode " << audioCtxMode << ", using full";
+		}
+		
+		p.vad_aggressiveness = std::clamp(config.getInt("vad_aggressiveness", p.vad_aggressiveness), 0, 3);
+		p.vad_start_ms       = std::max(10, config.getInt("vad_start_ms",      p.vad_start_ms));
+		p.vad_preroll_ms     = std::max(0,  config.getInt("vad_preroll_ms",    p.vad_preroll_ms));
+		p.vad_hangover_ms    = std::max(10, config.getInt("vad_hangover_ms",   p.vad_hangover_ms));
+		p.vad_min_speech_ms  = std::max(0,  config.getInt("vad_min_speech_ms", p.vad_min_speech_ms));
+		p.vad_energy_gate    = config.getBool("vad_energy_gate", p.vad_energy_gate);
+		p.vad_energy_gate_dbfs = std::min(0, config.getInt("vad_energy_gate_dbfs", p.vad_energy_gate_dbfs));
+		
+		LOG_INFO << "Decoding defaults: language=" << p.language << " translate=" << p.translate << " max_tokens=" << p.max_tokens
+			<< " audio_ctx=" << p.audio_ctx << " audio_ctx_mode=" << audioCtxMode << " speed_up=" << p.speed_up << " beam_size=" << p.beam_size << " best_of=" << p.best_of
+			<< " draft_max_ms=" << p.draft_max_ms << " draft_min_confidence=" << p.draft_min_confidence
+			<< " step_ms=" << p.step_ms << " max_utterance_ms=" << p.max_utterance_ms << " stream_partials=" << p.stream_partials
+			<< " vad_aggressiveness=" << p.vad_aggressiveness << " vad_start_ms=" << p.vad_start_ms << " vad_preroll_ms=" << p.vad_preroll_ms
+			<< " vad_hangover_ms=" << p.vad_hangover_ms << " vad_min_speech_ms=" << p.vad_min_speech_ms
+			<< " vad_energy_gate=" << p.vad_energy_gate << " vad_energy_gate_dbfs=" << p.vad_energy_gate_dbfs;
+		
+		return p;
+	}();
+	
+	return params;
+}
+
+//////////////////////////////////////////////
+//
+// the VAD works on 10 ms frames (nrVADSamples at 16 kHz)
+//
+//////////////////////////////////////////////
+static unsigned int msToFrames(int32_t ms)
+{
+	return (unsigned int) (ms / 10);
+}
+
+//////////////////////////////////////////////
+//
+// the "result" array of vosk: { "conf" : 0.95, "end" : 1.02, "start" : 0.84, "word" : "what" }, ...
+//
+//////////////////////////////////////////////
+static void appendWords(std::string& res, const std::vector<RecognitionResult>& words)
+{
+	char number[32];
+	
+	res += "\"result\" : [ ";
+	
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		const RecognitionResult& word = words[i];
+		
+		snprintf(number, sizeof(number), "%.6f", word.m_confidence);
+		res += "{ \"conf\" : ";
+		res += number;
+		
+		snprintf(number, sizeof(number), "%.3f", word.end.count() / 1000.0);
+		res += ", \"end\" : ";
+		res += number;
+		
+		snprintf(number, sizeof(number), "%.3f", word.start.count() / 1000.0);
+		res += ", \"start\" : ";
+		res += number;
+		
+		res += ", \"word\" : \"" + jsonEscape(word.text) + "\" }";
+		
+		if (i < (words.size() - 1))
+		{
+			res += ", ";
+		}
+	}
+	
+	res += " ], ";
+}
 
-	m_modelInstanceId = modelId;
+//////////////////////////////////////////////
+VoskRecognizer::VoskRecognizer(VoskModel *model, float sample_rate)
+{
+	m_modelInstanceId = model->getInstanceId();
 	m_instanceId      = voskRecognizerInstanceId++;
 	m_inputSampleRate = sample_rate;
 	
-	m_recoState = VoskRecognizerState::UNINIT;
+	LOG_INFO << "vosk_recognizer_new, instance=" << m_instanceId << " sample_rate=" << sample_rate;
+	
+	m_params = defaultParams();
+	m_maxAlternatives = 0;
+	
+	m_model = model;
+	m_model->acquire();
+	
+	// everything is set up before the first packet arrives, so no audio is lost;
+	// the model itself is shared and normally already loaded by vosk_model_new,
+	// whisper states are leased from its pool per decode
+	vad = new VADWrapper(m_params.vad_aggressiveness, m_processingSampleRate, msToFrames(m_params.vad_start_ms), msToFrames(m_params.vad_preroll_ms),
+		msToFrames(m_params.vad_hangover_ms), m_params.vad_energy_gate, m_params.vad_energy_gate_dbfs);
+	
+	audioLogger = nullptr;
+	if (VoskConfig::getInstance().getBool("log_audio", true) == true)
+	{
+		audioLogger = new AudioLogger(VoskConfig::getInstance().getString("log_path", "/logs/"), m_instanceId);
+	}
+	
+	audioInput = new AudioInput((int) m_inputSampleRate, m_processingSampleRate, vad);
+	
+	m_recoState = VoskRecognizerState::INIT;
+	
+	m_utteranceNr        = 0;
+	m_lastPartialSamples = 0;
+	m_partialWindowStart = 0;
+	m_partialTextEnd     = 0;
+	m_pieceDegraded      = false;
+	m_pieceConfidenceSum = 0.0f;
+	m_pieceSegments      = 0;
+	m_droppedUtterances  = 0;
 	
-	m_configPath = std::string(configPath);
+	m_utteranceStartFrame = 0;
+	
+	m_rejected = (InferenceScheduler::getInstance().admitSession() == false);
+	if (m_rejected == true)
+	{
+		LOG_WARNING << "Overload, rejecting instance " << m_instanceId << " until the decode queue is below its limit";
+		Metrics::getInstance().sessionsRejected.inc();
+	}
+	
+	Metrics::getInstance().recognizersAlive.add(1);
+	Metrics::getInstance().recognizersCreated.inc();
 }
 
 //////////////////////////////////////////////
 VoskRecognizer::~VoskRecognizer(void)
 {
-	std::cout << "vosk_recognizer_free, instance=" << m_instanceId << std::endl;
+	LOG_INFO << "vosk_recognizer_free, instance=" << m_instanceId;
 	
-	delete(audioLogger);
+	// nothing may still decode our audio or deliver results to us
+	InferenceScheduler::getInstance().cancel(this);
 	
-	whisper_free(ctx);
+	delete(audioLogger);
 	
 	m_recoState = VoskRecognizerState::UNINIT;
 	
+	delete(audioInput);
+	
 	delete(vad);
 	
 	partialResult.clear();
 	finalResults.clear();
 	
+	// model might be freed here if the server already dropped it
+	m_model->release();
+	
+	Metrics::getInstance().recognizersAlive.add(-1);
+	
 	// don't decrease, let every instance get a unique ID
 	// voskRecognizerInstanceId--;
 }
 
+//////////////////////////////////////////////
+//
+// vosk returns n-best alternatives, whisper only its best hypothesis: with
+// maxAlternatives > 0 the final result is in the vosk "alternatives" format
+// with that single entry (the beam size stays as configured)
+//
+//////////////////////////////////////////////
+void VoskRecognizer::setMaxAlternatives(int maxAlternatives)
+{
+	m_maxAlternatives = std::max(0, maxAlternatives);
+}
+
+//////////////////////////////////////////////
+void VoskRecognizer::setWords(bool words)
+{
+	m_params.words = words;
+}
+
 //////////////////////////////////////////////
 int VoskRecognizer::acceptWaveform(const char *data, int length)
 {
 	int status;
 	bool noMoreData;
 	
-	// if not yet initalized, do that here and discard this audio
-	if (m_recoState == VoskRecognizerState::UNINIT)
-	{
-		// whisper init
-		ctx = whisper_init_from_file(m_configPath.c_str());
-
-		pcmf32.clear();
-		
-		vad = new VADWrapper(3, m_processingSampleRate);
-		
-		audioLogger = new AudioLogger(std::string("/logs/"), m_instanceId);
-		
-		WebRtcSpl_ResetResample48khzTo16khz(&m_resamplestate_48_to_16);
-
-		m_recoState = VoskRecognizerState::INIT;
-		
-		return 0;
-	}
+	size_t maxUtteranceSamples = std::min((size_t) n_samples_30s, (size_t) ((m_params.max_utterance_ms * m_processingSampleRate) / 1000));
 	
-	if ((m_inputSampleRate != 48000) || (m_processingSampleRate != 16000))
+	if (m_rejected == true)
 	{
-		// only 48kHz-->16kHz is supported (both VAD and recognizer)
-		// e.g. Jitsi provides 48 kHz so we need to downsample 1:3
-		std::cout << "Unsupported sampling rates input " << m_inputSampleRate << " Hz and processing " << m_processingSampleRate << "Hz." << std::endl;
-		assert(false);	
-	}
-	
-	// splitting audio into chunks & resampling to 16kHz
-	const int framelen48=480;
-	const int framelen16=160;
-	int32_t tmp[framelen48 + 256] = { 0 };
-	int16_t buf[framelen16];
-	
-	while(leftOverDataLen + length >= framelen48 * 2){
-
-		int useLen = framelen48 * 2 - leftOverDataLen;
-		memcpy(leftOverData + leftOverDataLen, data, useLen);
-		data += useLen;
-		length -= useLen;
-		leftOverDataLen = 0;
-
-		WebRtcSpl_Resample48khzTo16khz((const int16_t*)leftOverData,buf,&m_resamplestate_48_to_16,tmp);
-  
-		// TODO we could remove all leftover handling from VAD
-		status = vad->process(m_processingSampleRate, buf, framelen16);
-	
-		if (status == -1)
+		if (InferenceScheduler::getInstance().isOverloaded() == true)
 		{
-			std::cout << "VAD processing error!" << std::endl;	
+			return 0;
 		}
+		
+		LOG_INFO << "Overload is over, admitting instance " << m_instanceId;
+		m_rejected = false;
 	}
-
-	if (length > 0)
+	
+	// a packet may end within a sample, the byte is kept for the next one
+	status = audioInput->process(data, (size_t) std::max(0, length));
+	
+	if (status == -1)
 	{
-		leftOverDataLen=length;
-		memcpy(leftOverData,data,length);
+		LOG_ERROR << "VAD processing error!";	
 	}
 	
 	noMoreData = vad->analyze();
@@ -119,70 +299,56 @@ int VoskRecognizer::acceptWaveform(const char *data, int length)
 		
 		while (availableChunks > 0)
 		{
-			std::unique_ptr<VADFrame<VADWrapper::nrVADSamples>> chunk = vad->getNextChunk();
+			const VADFrame<VADWrapper::nrVADSamples>& chunk = vad->getNextChunk();
+			
+			if (utteranceSamples.size() == 0)
+			{
+				m_utteranceStartFrame = chunk.number;
+			}
+			
+			utteranceSamples.insert(utteranceSamples.end(), std::begin(chunk.samples), std::end(chunk.samples));
 			
-			pcmf32.insert(pcmf32.cend(), std::begin(chunk->fSamples), std::end(chunk->fSamples));
+			int64_t energy = 0;
+			for (short sample : chunk.samples)
+			{
+				energy += (int32_t) sample * sample;
+			}
+			frameEnergy.push_back((float) energy);
 			
-			audioLogger->addChunk(std::move(chunk));
+			if (audioLogger != nullptr)
+			{
+				audioLogger->addChunk(chunk);
+			}
 			
 			availableChunks--;
+			
+			// back in idle state: that was the last frame, the utterance is complete
+			// (before the next one can start within the same packet); checked before
+			// the length, a split right at the end would leave nothing to complete
+			if (vad->getUtteranceStatus() == VADWrapperState::IDLE)
+			{
+				completeUtterance();
+			}
+			// never let a single utterance grow beyond the limit
+			else if (utteranceSamples.size() >= maxUtteranceSamples)
+			{
+				splitUtterance();
+			}
 		}
 		
 		noMoreData = vad->analyze();
 	}
 	
-	// if we are in idle state (again), a possible partial result is now final
-	if (pcmf32.size() > 0)
+	// an utterance is still growing
+	if (utteranceSamples.size() > 0)
 	{
-		if (vad->getUtteranceStatus() == VADWrapperState::IDLE)
+		if (m_params.stream_partials == true)
 		{
-			// run whisper on the current state of audio buffer
-			whisper_params params;
-			whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-		
-			wparams.print_progress   = false;
-			wparams.print_special    = params.print_special;
-			wparams.print_realtime   = false;
-			wparams.print_timestamps = !params.no_timestamps;
-			wparams.translate        = params.translate;
-			wparams.single_segment   = false; // !use_vad;
-			wparams.max_tokens       = params.max_tokens;
-			wparams.language         = params.language.c_str();
-			wparams.n_threads        = params.n_threads;
-		
-			wparams.audio_ctx        = params.audio_ctx;
-			wparams.speed_up         = params.speed_up;
-		
-			wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-		
-			// disable temperature fallback
-			//wparams.temperature_inc  = -1.0f;
-			wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
-		
-			wparams.prompt_tokens    = nullptr; // params.no_context ? nullptr : prompt_tokens.data();
-			wparams.prompt_n_tokens  = 0;       // params.no_context ? 0       : prompt_tokens.size();
-		
-			std::cout << "Push audio to whisper, size=" << pcmf32.size() << std::endl;
-			if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
-				fprintf(stderr, "whisper_full(): failed to process audio\n");
-				assert(false);
-			}
-	
-			partialResult.clear();
-			
-			const int n_segments = whisper_full_n_segments(ctx);
-			for (int i = 0; i < n_segments; ++i) {
-				const char * text = whisper_full_get_segment_text(ctx, i);
-		
-				const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-				const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-		
-				std::unique_ptr<RecognitionResult> newResult = std::make_unique<RecognitionResult>(const_cast<char*>(text), (unsigned int) t0, (unsigned int) t1, 1.0f);
-				partialResult.push_back(std::move(newResult));
+			// decode the current state of the utterance every step_ms
+			if ((utteranceSamples.size() - m_lastPartialSamples) >= (size_t) ((m_params.step_ms * m_processingSampleRate) / 1000))
+			{
+				submitPartial();
 			}
-			
-			promoteToFinalResult();
-			pcmf32.clear();
 		}
 		else
 		{
@@ -191,6 +357,8 @@ int VoskRecognizer::acceptWaveform(const char *data, int length)
 		}
 	}
 	
+	std::lock_guard<std::mutex> lock(m_resultMutex);
+	
 	if (finalResults.size() > 0)
 	{
 		// at least one final utterance can be read
@@ -201,6 +369,400 @@ int VoskRecognizer::acceptWaveform(const char *data, int length)
 	return 0;
 }
 
+//////////////////////////////////////////////
+//
+// decoding parameters shared by complete and partial utterances
+//
+//////////////////////////////////////////////
+std::unique_ptr<DecodeJob> VoskRecognizer::createDecodeJob(void)
+{
+	std::unique_ptr<DecodeJob> job = std::make_unique<DecodeJob>();
+	
+	job->owner = this;
+	job->ctx   = m_model->getContext();
+	job->decoders = &m_model->getDecoderPool();
+	
+	VoskModel *draft = m_model->getDraft();
+	job->draftCtx           = (draft != nullptr) ? draft->getContext() : nullptr;
+	job->draftDecoders      = (draft != nullptr) ? &draft->getDecoderPool() : nullptr;
+	job->draftMinConfidence = m_params.draft_min_confidence;
+	job->draftMaxSamples    = ((size_t) m_params.draft_max_ms * m_processingSampleRate) / 1000;
+	
+	bool beamSearch = (m_params.beam_size > 1);
+	
+	job->wparams = whisper_full_default_params(beamSearch ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+	
+	if (beamSearch == true)
+	{
+		job->wparams.beam_search.beam_size = m_params.beam_size;
+	}
+	else if (m_params.best_of > 0)
+	{
+		job->wparams.greedy.best_of = m_params.best_of;
+	}
+
+	job->wparams.print_progress   = false;
+	job->wparams.print_special    = m_params.print_special;
+	job->wparams.print_realtime   = false;
+	job->wparams.print_timestamps = !m_params.no_timestamps;
+	job->wparams.translate        = m_params.translate;
+	job->wparams.single_segment   = false; // !use_vad;
+	job->wparams.max_tokens       = m_params.max_tokens;
+
+	job->wparams.audio_ctx        = m_params.audio_ctx;
+	job->wparams.speed_up         = m_params.speed_up;
+
+	job->wparams.tdrz_enable      = m_params.tinydiarize; // [TDRZ]
+	
+	// per-token times for the words of the result, costs a little extra time
+	job->wparams.token_timestamps = m_params.words;
+
+	// disable temperature fallback
+	//job->wparams.temperature_inc  = -1.0f;
+	job->wparams.temperature_inc  = m_params.no_fallback ? 0.0f : job->wparams.temperature_inc;
+
+	// prompt tokens are set by the scheduler from job->promptTokens
+	job->wparams.prompt_tokens    = nullptr;
+	job->wparams.prompt_n_tokens  = 0;
+	
+	job->language = m_params.language;
+	
+	// the context is chosen by the scheduler, it knows the final length (e.g. of a batch)
+	job->adaptiveAudioCtx  = m_params.adaptive_audio_ctx;
+	job->audioCtxPaddingMs = m_params.audio_ctx_padding_ms;
+	job->audioCtxMinMs     = m_params.audio_ctx_min_ms;
+	
+	job->isPartial   = false;
+	job->partialEnd  = 0;
+	job->isLastPiece = true;
+	job->logId       = 0;
+	job->dropped     = false;
+	job->degraded    = false;
+	
+	job->streamOffsetMs = (m_utteranceStartFrame * VADWrapper::nrVADSamples * 1000) / m_processingSampleRate;
+	
+	std::lock_guard<std::mutex> lock(m_resultMutex);
+	job->utteranceNr = m_utteranceNr;
+	
+	return job;
+}
+
+//////////////////////////////////////////////
+//
+// the VAD found the end of the utterance: decode it unless it is too short
+// to be speech, a click or a cough would still cost a full whisper run
+//
+//////////////////////////////////////////////
+void VoskRecognizer::completeUtterance(void)
+{
+	unsigned int speechMs = vad->getUtteranceSpeechFrames() * ((VADWrapper::nrVADSamples * 1000) / m_processingSampleRate);
+	
+	if (speechMs < (unsigned int) m_params.vad_min_speech_ms)
+	{
+		LOG_DEBUG << "Discarding utterance with " << speechMs << " ms of speech, instance=" << m_instanceId;
+		
+		utteranceSamples.clear();
+		frameEnergy.clear();
+		
+		if (audioLogger != nullptr)
+		{
+			audioLogger->discardUtterance();
+		}
+		
+		// partial results of it are outdated
+		restartPartials();
+		
+		Metrics::getInstance().utterancesDiscarded.inc();
+	}
+	else
+	{
+		// decoding happens in the background, the final result is picked up by a later call
+		submitUtterance();
+	}
+	
+	partialResult.clear();
+}
+
+//////////////////////////////////////////////
+//
+// hands the collected utterance over to the InferenceScheduler
+//
+//////////////////////////////////////////////
+void VoskRecognizer::submitUtterance(void)
+{
+	// whisper gets no empty audio, pieces of a split utterance waiting for
+	// this last one are completed by getLastResult() at the latest
+	if (utteranceSamples.size() == 0)
+	{
+		LOG_WARNING << "Not queueing empty utterance, instance=" << m_instanceId;
+		return;
+	}
+	
+	std::unique_ptr<DecodeJob> job = createDecodeJob();
+	
+	job->samples.assign(utteranceSamples.begin(), utteranceSamples.end());
+	utteranceSamples.clear();
+	frameEnergy.clear();
+	
+	if (audioLogger != nullptr)
+	{
+		job->logId = audioLogger->closeUtterance();
+	}
+	
+	// partial results still being decoded for this utterance are outdated now
+	restartPartials();
+	
+	Metrics::getInstance().utterances.inc();
+	
+	LOG_DEBUG << "Queueing utterance for decoding, instance=" << m_instanceId << " size=" << job->samples.size();
+	
+	InferenceScheduler::getInstance().submit(std::move(job));
+}
+
+//////////////////////////////////////////////
+//
+// the utterance reached its maximum length: cut it at the quietest frame of the
+// last split_search_ms and decode the first part as a piece of its own
+//
+// the speech after the cut stays in the buffer and continues the utterance
+//
+//////////////////////////////////////////////
+void VoskRecognizer::splitUtterance(void)
+{
+	size_t searchFrames = (m_params.split_search_ms * m_processingSampleRate) / (1000 * VADWrapper::nrVADSamples);
+	size_t firstFrame   = (frameEnergy.size() > searchFrames) ? (frameEnergy.size() - searchFrames) : 0;
+	size_t splitFrame   = firstFrame;
+	
+	for (size_t i = firstFrame; i < frameEnergy.size(); i++)
+	{
+		if (frameEnergy[i] < frameEnergy[splitFrame])
+		{
+			splitFrame = i;
+		}
+	}
+	
+	// the quietest frame goes into the first piece, so that at least one frame is decoded
+	size_t splitSample = (splitFrame + 1) * VADWrapper::nrVADSamples;
+	
+	std::unique_ptr<DecodeJob> job = createDecodeJob();
+	
+	job->isLastPiece = false;
+	job->samples.assign(utteranceSamples.begin(), utteranceSamples.begin() + splitSample);
+	
+	utteranceSamples.erase(utteranceSamples.begin(), utteranceSamples.begin() + splitSample);
+	frameEnergy.erase(frameEnergy.begin(), frameEnergy.begin() + splitFrame + 1);
+	m_utteranceStartFrame += splitFrame + 1;
+	
+	// partial results restart with the remaining speech
+	restartPartials();
+	
+	// the frames after the cut are logged with the rest of the utterance
+	if (audioLogger != nullptr)
+	{
+		job->logId = audioLogger->closeUtterance(splitSample);
+	}
+	
+	Metrics::getInstance().utteranceSplits.inc();
+	
+	LOG_INFO << "Splitting over-long utterance, instance=" << m_instanceId << " piece size=" << job->samples.size() << " remaining=" << utteranceSamples.size();
+	
+	InferenceScheduler::getInstance().submit(std::move(job));
+}
+
+//////////////////////////////////////////////
+//
+// the utterance ended or was split: partial results start over with the
+// next audio, those still being decoded are outdated
+//
+//////////////////////////////////////////////
+void VoskRecognizer::restartPartials(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		m_utteranceNr++;
+		m_partialText.clear();
+		m_partialPrefix.clear();
+		m_partialTextEnd = 0;
+	}
+	
+	m_lastPartialSamples = 0;
+	m_partialWindowStart = 0;
+}
+
+//////////////////////////////////////////////
+//
+// decodes the part of the still growing utterance since the start of the
+// partial window for a partial result
+//
+// once the window is longer than length_ms, the latest partial text becomes
+// fixed and the window restarts where the audio of that text ended, so long
+// utterances keep their earlier words; the text before the window (or else
+// the previous utterance's) is used as prompt
+//
+//////////////////////////////////////////////
+void VoskRecognizer::submitPartial(void)
+{
+	std::unique_ptr<DecodeJob> job = createDecodeJob();
+	std::string prompt;
+	
+	size_t windowSamples = (m_params.length_ms * m_processingSampleRate) / 1000;
+	
+	{
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		
+		// only text that has arrived can be fixed, until then the window keeps growing
+		if (((utteranceSamples.size() - m_partialWindowStart) > windowSamples) && (m_partialTextEnd > m_partialWindowStart))
+		{
+			if ((m_partialPrefix.size() > 0) && (m_partialText.size() > 0))
+			{
+				m_partialPrefix += " ";
+			}
+			m_partialPrefix += m_partialText;
+			m_partialText.clear();
+			
+			m_partialWindowStart = m_partialTextEnd;
+			
+			// partials of the old window still being decoded are outdated
+			m_utteranceNr++;
+			job->utteranceNr = m_utteranceNr;
+		}
+		
+		// continue the text before the window, of a split utterance, otherwise the previous utterance
+		prompt = m_pieceText;
+		if ((prompt.size() > 0) && (m_partialPrefix.size() > 0))
+		{
+			prompt += " ";
+		}
+		prompt += m_partialPrefix;
+		
+		if (prompt.size() == 0)
+		{
+			prompt = m_lastFinalText;
+		}
+	}
+	
+	job->isPartial  = true;
+	job->partialEnd = utteranceSamples.size();
+	job->samples.assign(utteranceSamples.begin() + m_partialWindowStart, utteranceSamples.end());
+	
+	job->wparams.single_segment   = true;
+	job->wparams.print_timestamps = false;
+	job->wparams.token_timestamps = false;
+	job->wparams.no_context       = true;
+	
+	job->streamOffsetMs += (m_partialWindowStart * 1000) / m_processingSampleRate;
+	
+	if (prompt.size() > 0)
+	{
+		// partials are decoded by the draft model if there is one
+		struct whisper_context* ctx = (job->draftCtx != nullptr) ? job->draftCtx : job->ctx;
+		
+		// whisper accepts at most half of the text context as prompt, the end of the text matters most
+		size_t maxTokens = whisper_n_text_ctx(ctx) / 2;
+		
+		// every token covers at least one byte, so the whole prompt always fits
+		// (whisper_tokenize() only returns -1 if it doesn't, not the size needed)
+		if (m_promptTokens.size() < (prompt.size() + 1))
+		{
+			m_promptTokens.resize(prompt.size() + 1);
+		}
+		
+		int nrTokens = whisper_tokenize(ctx, prompt.c_str(), m_promptTokens.data(), m_promptTokens.size());
+		
+		if (nrTokens < 0)
+		{
+			LOG_WARNING << "Could not tokenize prompt of " << prompt.size() << " bytes, partial result without prompt.";
+		}
+		else if ((size_t) nrTokens > maxTokens)
+		{
+			// too long, keep its last tokens
+			LOG_DEBUG << "Prompt of " << nrTokens << " tokens cut to the last " << maxTokens << ".";
+			job->promptTokens.assign(m_promptTokens.begin() + (nrTokens - maxTokens), m_promptTokens.begin() + nrTokens);
+		}
+		else
+		{
+			job->promptTokens.assign(m_promptTokens.begin(), m_promptTokens.begin() + nrTokens);
+		}
+	}
+	
+	m_lastPartialSamples = utteranceSamples.size();
+	
+	InferenceScheduler::getInstance().submit(std::move(job));
+}
+
+//////////////////////////////////////////////
+//
+// called by a scheduler worker once the utterance was decoded
+//
+//////////////////////////////////////////////
+void VoskRecognizer::decodeFinished(std::unique_ptr<DecodeJob> job)
+{
+	if (job->isPartial == true)
+	{
+		std::string partialText;
+		
+		for (auto& result : job->results)
+		{
+			partialText += result->text;
+		}
+		
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		
+		// the utterance might have been completed (or the window moved on) meanwhile
+		if (job->utteranceNr == m_utteranceNr)
+		{
+			m_partialText    = partialText;
+			m_partialTextEnd = job->partialEnd;
+		}
+		
+		return;
+	}
+	
+	if (job->dropped == true)
+	{
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		m_droppedUtterances += 1 + job->mergedLogIds.size();
+	}
+	
+	// a dropped last piece still completes the pieces decoded before
+	promoteToFinalResult(job.get());
+	
+	// the later utterances dropped with it are logged without text as well
+	if (audioLogger != nullptr)
+	{
+		for (unsigned long long logId : job->mergedLogIds)
+		{
+			audioLogger->flush(logId, "");
+		}
+	}
+}
+
+//////////////////////////////////////////////
+//
+// reported with the results, so a client can show that text is missing or
+// less accurate (empty if everything is fine); m_resultMutex must be held
+//
+//////////////////////////////////////////////
+std::string VoskRecognizer::getOverloadStatus(void)
+{
+	if (m_rejected == true)
+	{
+		return "rejected";
+	}
+	
+	if (m_droppedUtterances > 0)
+	{
+		return "dropped";
+	}
+	
+	if (InferenceScheduler::getInstance().isOverloaded() == true)
+	{
+		return "busy";
+	}
+	
+	return "";
+}
+
 //////////////////////////////////////////////
 const char* VoskRecognizer::getPartialResult(void)
 {
@@ -217,60 +779,228 @@ const char* VoskRecognizer::getPartialResult(void)
 			}
 		}
 	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		std::string text = m_pieceText;
+		
+		for (const std::string* part : { &m_partialPrefix, &m_partialText })
+		{
+			if ((text.size() > 0) && (part->size() > 0))
+			{
+				text += " ";
+			}
+			text += *part;
+		}
+		
+		res += jsonEscape(text);
+	}
+	
+	res += "\"";
+	
+	{
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		std::string overload = getOverloadStatus();
+		if (overload.size() > 0)
+		{
+			res += ", \"overload\" : \"" + overload + "\"";
+		}
+	}
 	
-	res += "\" }";
+	res += " }";
 	
-	std::cout << "Partial result: " << res << std::endl;
+	LOG_DEBUG << "Partial result: " << res;
 	
-	memset(partialResultBuffer, 0, sizeof(partialResultBuffer));
-	strncpy(partialResultBuffer, res.c_str(), sizeof(partialResultBuffer) - 1);
+	m_partialResultJson = res;
 	
-	return partialResultBuffer;	
+	return m_partialResultJson.c_str();
 }
 
 //////////////////////////////////////////////
 const char* VoskRecognizer::getFinalResult(void)
 {
-	std::string res = "{ \"text\" : \"-- ";
+	std::string res = "{ ";
+	std::string overload;
 	
-	if (finalResults.size() > 0)
 	{
-		std::string currFinalResult = finalResults.front();
-		audioLogger->flush(currFinalResult);
-		res += currFinalResult;
-		finalResults.erase(finalResults.begin());
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		
+		overload = getOverloadStatus();
+		m_droppedUtterances = 0;
+		
+		// the only alternative there is, vosk clients asking for alternatives parse nothing else
+		if (m_maxAlternatives > 0)
+		{
+			char number[32];
+			snprintf(number, sizeof(number), "%.6f", (finalResults.size() > 0) ? finalResults.front().confidence : 0.0f);
+			
+			res += "\"alternatives\" : [ { \"confidence\" : ";
+			res += number;
+			res += ", ";
+		}
+		
+		if ((finalResults.size() > 0) && (m_params.words == true))
+		{
+			appendWords(res, finalResults.front().words);
+		}
+		
+		res += "\"text\" : \"-- ";
+		
+		if (finalResults.size() > 0)
+		{
+			res += jsonEscape(finalResults.front().text);
+			
+			// a dropped or rejected utterance is more important to know about
+			if ((overload.size() == 0) || (overload == "busy"))
+			{
+				overload = (finalResults.front().overload.size() > 0) ? finalResults.front().overload : overload;
+			}
+			
+			Metrics::getInstance().finalResultWaitSeconds.observe(
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - finalResults.front().ready).count());
+			
+			finalResults.erase(finalResults.begin());
+		}
 	}
 	
-	res += " --\" }";
+	res += " --\"";
 	
-	std::cout << "Final result: " << res << std::endl;
+	if (m_maxAlternatives > 0)
+	{
+		res += " } ]";
+	}
+	
+	if (overload.size() > 0)
+	{
+		res += ", \"overload\" : \"" + overload + "\"";
+	}
+	
+	res += " }";
 	
-	memset(finalResultBuffer, 0, sizeof(finalResultBuffer));
-	strncpy(finalResultBuffer, res.c_str(), sizeof(finalResultBuffer) - 1);
+	LOG_INFO << "Final result: " << res;
 	
-	return finalResultBuffer;	
+	m_finalResultJson = res;
+	
+	return m_finalResultJson.c_str();
 }
 
 //////////////////////////////////////////////
-void VoskRecognizer::promoteToFinalResult(void)
+//
+// end of stream: blocks until all utterances handed over so far are decoded
+// and returns all final results that were not fetched yet
+//
+//////////////////////////////////////////////
+const char* VoskRecognizer::getLastResult(void)
 {
-	std::string finalResult;
+	// the stream ended within the hangover of an utterance, it is complete as well
+	if (utteranceSamples.size() > 0)
+	{
+		completeUtterance();
+	}
+	
+	InferenceScheduler::getInstance().waitIdle(this);
 	
-	if (partialResult.size() > 0)
 	{
-		for (unsigned int i = 0; i < partialResult.size(); i++)
+		std::lock_guard<std::mutex> lock(m_resultMutex);
+		
+		// pieces of a split utterance whose last piece never came (the stream ended right after a split)
+		promotePieces();
+		
+		// the server fetches only one more result, so join everything left (the oldest one decides the wait time)
+		while (finalResults.size() > 1)
 		{
-			finalResult += partialResult[i]->text;
-			if (i < (partialResult.size() - 1))
+			finalResults[1].text  = finalResults[0].text + " " + finalResults[1].text;
+			finalResults[1].ready = finalResults[0].ready;
+			finalResults[1].confidence = std::min(finalResults[0].confidence, finalResults[1].confidence);
+			finalResults[1].words.insert(finalResults[1].words.begin(), finalResults[0].words.begin(), finalResults[0].words.end());
+			if (finalResults[1].overload.size() == 0)
 			{
-				finalResult += " ";
+				finalResults[1].overload = finalResults[0].overload;
 			}
+			finalResults.erase(finalResults.begin());
 		}
+	}
+	
+	return getFinalResult();
+}
+
+//////////////////////////////////////////////
+void VoskRecognizer::promoteToFinalResult(DecodeJob *job)
+{
+	std::vector<std::unique_ptr<RecognitionResult>>& results = job->results;
+	std::string finalResult;
+	
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		finalResult += results[i]->text;
+		if (i < (results.size() - 1))
+		{
+			finalResult += " ";
+		}
+	}
+	
+	// also log utterances without any text
+	if (audioLogger != nullptr)
+	{
+		audioLogger->flush(job->logId, finalResult);
+	}
+	
+	std::chrono::milliseconds offset(job->streamOffsetMs);
+	
+	std::lock_guard<std::mutex> lock(m_resultMutex);
+	
+	// pieces of a split utterance arrive in order, collect them until the last one
+	if (results.size() > 0)
+	{
+		if (m_pieceText.size() > 0)
+		{
+			m_pieceText += " ";
+		}
+		m_pieceText += finalResult;
+		m_pieceDegraded = m_pieceDegraded || job->degraded;
 		
-		std::cout << "Promoting partial result to final: " << finalResult << std::endl;
-		
-		finalResults.push_back(finalResult);
-		
-		partialResult.clear();
+		for (auto& result : results)
+		{
+			m_pieceConfidenceSum += result->m_confidence;
+			m_pieceSegments++;
+			
+			for (RecognitionResult& word : result->words)
+			{
+				word.start += offset;
+				word.end   += offset;
+				m_pieceWords.push_back(std::move(word));
+			}
+		}
 	}
+	
+	if (job->isLastPiece == true)
+	{
+		promotePieces();
+	}
+}
+
+//////////////////////////////////////////////
+//
+// the collected pieces (if any text) become one final result,
+// m_resultMutex must be held
+//
+//////////////////////////////////////////////
+void VoskRecognizer::promotePieces(void)
+{
+	if (m_pieceText.size() == 0)
+	{
+		return;
+	}
+	
+	LOG_DEBUG << "Promoting partial result to final: " << m_pieceText;
+	
+	float confidence = (m_pieceSegments > 0) ? (m_pieceConfidenceSum / m_pieceSegments) : 0.0f;
+	
+	finalResults.push_back({ m_pieceText, std::chrono::steady_clock::now(), (m_pieceDegraded == true) ? "degraded" : "", std::move(m_pieceWords), confidence });
+	m_lastFinalText = m_pieceText;
+	m_pieceText.clear();
+	m_pieceWords.clear();
+	m_pieceDegraded = false;
+	m_pieceConfidenceSum = 0.0f;
+	m_pieceSegments      = 0;
 }
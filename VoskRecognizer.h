@@ -1,7 +1,11 @@
 #ifndef VOSK_RECOGNIZER_H
 #define VOSK_RECOGNIZER_H
 
-#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 extern "C" {
@@ -11,58 +15,93 @@ extern "C" {
 #include <VADWrapper.h>
 #include <RecognitionResult.h>
 #include <AudioLogger.h>
-extern "C" {
-#include "common_audio/signal_processing/include/signal_processing_library.h"
-}
+#include <VoskModel.h>
+#include <InferenceScheduler.h>
+#include <AudioInput.h>
 
 #include "whisper.h"
 
 enum VoskRecognizerState {UNINIT, INIT};
 
-// command-line parameters from stream example
+// decoding parameters of a session, originally the command-line parameters of the stream example
+// (compiled in defaults, overridden by VoskConfig, some can be changed per session)
+// (number of threads is decided by the InferenceScheduler)
 struct whisper_params {
-    int32_t n_threads  = 12; // TODO hard-coded
-    int32_t step_ms    = 3000;
-    int32_t length_ms  = 10000;
-    int32_t keep_ms    = 200;
-    int32_t capture_id = -1;
+    int32_t step_ms    = 1500; // partial result every step_ms of speech
+    int32_t length_ms  = 10000; // partial results: longer windows fix their text and start a new one
+    int32_t max_utterance_ms = 20000; // longer utterances are split (at most 30s)
+    int32_t split_search_ms  = 1000;  // split at the quietest frame within this range
     int32_t max_tokens = 32;
-    int32_t audio_ctx  = 0;
+    int32_t audio_ctx  = 0; // encoder frames (20 ms each), 0: full 30 s window
+    int32_t audio_ctx_padding_ms = 1000; // adaptive: context covers the audio plus this
+    int32_t audio_ctx_min_ms     = 3000; // adaptive: but never less than this
+    int32_t beam_size  = 0; // 0 or 1: greedy sampling
+    int32_t best_of    = 0; // greedy candidates, 0: whisper's default
+    int32_t draft_max_ms = 10000; // cascade: longer utterances skip the draft model, 0: no limit
+    float   draft_min_confidence = 0.6f; // cascade: less certain draft results are decoded again
 
-    float vad_thold    = 0.6f;
-    float freq_thold   = 100.0f;
+    int32_t vad_aggressiveness = 3; // 0 (least) .. 3 (most aggressive)
+    int32_t vad_start_ms       = 50;  // speech needed to start an utterance
+    int32_t vad_preroll_ms     = 300; // audio kept before the start, word onsets are often missed by the VAD
+    int32_t vad_hangover_ms    = 500; // silence needed to end an utterance
+    int32_t vad_min_speech_ms  = 150; // utterances with less speech are not decoded (clicks, coughs)
+    int32_t vad_energy_gate_dbfs = -70; // quieter frames are silence without asking the VAD
+    bool    vad_energy_gate    = true;
 
     bool speed_up      = false;
     bool translate     = false;
     bool no_fallback   = false;
     bool print_special = false;
-    bool no_context    = true;
     bool no_timestamps = false;
     bool tinydiarize   = false;
+    bool adaptive_audio_ctx = false; // encoder context from the utterance length (faster, less accurate)
+    bool stream_partials = true;
+    bool words         = false;
 
     std::string language  = "en";
-    std::string model     = "models/ggml-base.en.bin";
-    std::string fname_out;
+};
+
+//////////////////////////////////////////////
+//
+// text of a complete utterance and when it became available
+//
+//////////////////////////////////////////////
+class FinalResult
+{
+public:
+	std::string text;
+	std::chrono::steady_clock::time_point ready;
+	// "degraded" if decoded with cheaper settings because of overload
+	std::string overload;
+	// with setWords, times are in the session's timeline
+	std::vector<RecognitionResult> words;
+	// mean confidence of its segments
+	float confidence;
 };
 
 //////////////////////////////////////////////
 class VoskRecognizer
 {
 public:
-	VoskRecognizer(int modelId, float sample_rate, const char *configPath);
+	VoskRecognizer(VoskModel *model, float sample_rate);
 	~VoskRecognizer(void);
 	int getInstanceId(void) { return m_instanceId; }
 	int getModelInstanceId(void) { return m_modelInstanceId; }
 	float getSampleRate(void) { return m_inputSampleRate; }
+	void setMaxAlternatives(int maxAlternatives);
+	void setWords(bool words);
 	int acceptWaveform(const char *data, int length);
 	void resultCallback(char* word, unsigned int startTimeMs, unsigned int endTimeMs, float negLogLikelihood);
 	const char* getPartialResult(void);
 	const char* getFinalResult(void);
+	const char* getLastResult(void);
+	void decodeFinished(std::unique_ptr<DecodeJob> job);
 	
 private:
 	static const ssize_t m_processingSampleRate = 16000;
 	
-	static int voskRecognizerInstanceId;
+	// recognizers are created by concurrent server sessions
+	static std::atomic<int> voskRecognizerInstanceId;
 
 	int m_instanceId;
 	int m_modelInstanceId;
@@ -70,27 +109,80 @@ private:
 	bool m_libraryLoaded;
 	VoskRecognizerState m_recoState;
 	
-	std::string m_configPath;
+	// decoding parameters of this session
+	whisper_params m_params;
+	
+	// > 0: final results in the vosk "alternatives" format
+	int m_maxAlternatives;
+	
+	// shared model, every recognizer holds a reference while alive
+	VoskModel *m_model;
 
-	struct whisper_context* ctx;
 	const int n_samples_30s  = (1e-3 * 30000.0) * WHISPER_SAMPLE_RATE;
-    std::vector<float> pcmf32;
+	
+	// all samples of the current utterance (capacity is kept between utterances)
+	std::vector<int16_t> utteranceSamples;
+	
+	// VAD frame number of its first sample, word times are relative to the session start
+	unsigned long long m_utteranceStartFrame;
+	
+	// energy of every VAD frame in utteranceSamples, used to find a good point to split over-long utterances
+	std::vector<float> frameEnergy;
 	
 	VADWrapper *vad;
 	
-	WebRtcSpl_State48khzTo16khz m_resamplestate_48_to_16;
-	char leftOverData[480*2] = {0};
-	int leftOverDataLen = 0;
+	// packets at any input rate --> VAD at the processing rate
+	AudioInput *audioInput;
 	
 	std::vector<std::unique_ptr<RecognitionResult>> partialResult;
 	
-	std::vector<std::string>                        finalResults;
+	// filled by the scheduler's workers, read by the server thread
+	std::mutex                                      m_resultMutex;
+	std::vector<FinalResult>                        finalResults;
+	
+	// text of the already decoded pieces of a split utterance (also guarded by m_resultMutex)
+	std::string        m_pieceText;
+	std::vector<RecognitionResult> m_pieceWords;
+	bool               m_pieceDegraded;
+	float              m_pieceConfidenceSum;
+	unsigned int       m_pieceSegments;
+	
+	// overload: utterances dropped since the last final result (also guarded by m_resultMutex)
+	unsigned int       m_droppedUtterances;
+	
+	// turned away at creation (overload policy reject), audio is ignored until the overload is over
+	bool               m_rejected;
+	
+	// streaming partial results (also guarded by m_resultMutex): the text
+	// before the partial window, the latest text of the window and where
+	// its audio ended (samples into the utterance)
+	std::string        m_partialPrefix;
+	std::string        m_partialText;
+	size_t             m_partialTextEnd;
+	std::string        m_lastFinalText;
+	// partial jobs of an older utterance (or window) are outdated
+	unsigned long long m_utteranceNr;
+	
+	// utterance size when the last partial decode was requested, and where the partial window starts
+	size_t m_lastPartialSamples;
+	size_t m_partialWindowStart;
+	
+	// prompt of a partial decode before it is cut to what whisper accepts (capacity is kept)
+	std::vector<whisper_token> m_promptTokens;
 	
-	// to avoid early deletion of string objects, use preallocated memory for the most recent string
-	char partialResultBuffer[1000];
-	char finalResultBuffer[1000];
+	// the returned JSON stays valid until the next call (capacity is kept between calls)
+	std::string m_partialResultJson;
+	std::string m_finalResultJson;
 	
-	void promoteToFinalResult(void);
+	std::unique_ptr<DecodeJob> createDecodeJob(void);
+	void completeUtterance(void);
+	void submitUtterance(void);
+	void submitPartial(void);
+	void restartPartials(void);
+	void splitUtterance(void);
+	void promoteToFinalResult(DecodeJob *job);
+	void promotePieces(void);
+	std::string getOverloadStatus(void);
 	
 	AudioLogger *audioLogger;
 };
@@ -3,4 +3,12 @@
 # VOSK_SAMPLE_RATE=48000 /vosk_whisper_server 0.0.0.0 2700 1 /uasr-data/whisper-small_hsb_23_08_07/ggml-model.bin
 # VOSK_SAMPLE_RATE=48000 /vosk_whisper_server 0.0.0.0 2700 1 /uasr-data/whisper-small_hsb_23_08_07/ggml-model-q5_0.bin
 
+# decoding, VAD and logging settings are read from the config file,
+# single settings can be overridden by environment, e.g. VOSK_LANGUAGE=hsb
+export VOSK_CONFIG=${VOSK_CONFIG:-/vosk_whisper.conf}
+
+# cascade: the base model decodes first, the small model only uncertain or long utterances
+# export VOSK_DRAFT_MODEL=/uasr-data/whisper-base_hsb_2023_08_15/ggml-model.q5_0.bin
+# VOSK_SAMPLE_RATE=48000 /vosk_whisper_server 0.0.0.0 2700 1 /uasr-data/whisper-small_hsb_23_08_07/ggml-model-q5_0.bin
+
 VOSK_SAMPLE_RATE=48000 /vosk_whisper_server 0.0.0.0 2700 1 /uasr-data/whisper-base_hsb_2023_08_15/ggml-model.q5_0.bin
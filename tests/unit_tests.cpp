@@ -0,0 +1,401 @@
+//////////////////////////////////////////////
+//
+// unit tests of the parts that don't need whisper: configuration parsing,
+// resampling, the packet and VAD frame pipeline and the ADPCM codec of the archive
+//
+// unit_tests [name]...   runs all tests or the named ones, the exit code
+//                        is the number of failed checks (0 = all passed)
+//
+// built and registered with ctest by the CMake build (VOSK_WHISPER_BUILD_TESTS)
+//
+//////////////////////////////////////////////
+
+#include <AdpcmCodec.h>
+#include <AudioInput.h>
+#include <Metrics.h>
+#include <Resampler.h>
+#include <VADFrameRing.h>
+#include <VADWrapper.h>
+#include <VoskConfig.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(condition) checkCondition((condition), #condition, __FILE__, __LINE__)
+
+//////////////////////////////////////////////
+static void checkCondition(bool condition, const char *text, const char *file, int line)
+{
+	if (condition == false)
+	{
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+		failures++;
+	}
+}
+
+//////////////////////////////////////////////
+static std::vector<int16_t> sine(double frequency, int rate, size_t length, double amplitude)
+{
+	std::vector<int16_t> samples(length);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		samples[i] = (int16_t) std::lround(amplitude * std::sin(2.0 * M_PI * frequency * i / rate));
+	}
+
+	return samples;
+}
+
+//////////////////////////////////////////////
+static double rms(const int16_t *samples, size_t length)
+{
+	double sum = 0.0;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		sum += (double) samples[i] * samples[i];
+	}
+
+	return (length > 0) ? std::sqrt(sum / length) : 0.0;
+}
+
+//////////////////////////////////////////////
+//
+// VoskConfig is read once per process, so this has to run before anything
+// else asks for it (Metrics does)
+//
+//////////////////////////////////////////////
+static void testConfig(void)
+{
+	char path[] = "/tmp/vosk_unit_tests_XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	close(fd);
+
+	{
+		std::ofstream out(path);
+		out << "# comment line\n";
+		out << "\n";
+		out << "language = de   # trailing comment\n";
+		out << "  max_tokens=16\n";
+		out << "translate = yes\n";
+		out << "words = off\n";
+		out << "draft_min_confidence = 0.75\n";
+		out << "beam_size = five\n";
+		out << "best_of = 5\n";
+		out << "line without separator\n";
+	}
+
+	setenv("VOSK_CONFIG", path, 1);
+	setenv("VOSK_BEST_OF", "3", 1);
+
+	VoskConfig& config = VoskConfig::getInstance();
+
+	CHECK(config.getString("language", "en") == "de");
+	CHECK(config.getString("missing", "fallback") == "fallback");
+	CHECK(config.getInt("max_tokens", 32) == 16);
+	CHECK(config.getBool("translate", false) == true);
+	CHECK(config.getBool("words", true) == false);
+	CHECK(std::fabs(config.getFloat("draft_min_confidence", 0.6f) - 0.75f) < 1e-6f);
+
+	// not a number: the default
+	CHECK(config.getInt("beam_size", 0) == 0);
+
+	// the environment wins over the file
+	CHECK(config.getInt("best_of", 0) == 3);
+
+	unlink(path);
+}
+
+//////////////////////////////////////////////
+static void testResamplerRates(void)
+{
+	const int rates[] = { 8000, 16000, 22050, 32000, 44100, 48000 };
+
+	for (int rate : rates)
+	{
+		// one second in, one second out (the filter delay is made up by its initial silence)
+		Resampler resampler(rate, 16000);
+		std::vector<int16_t> input = sine(440.0, rate, rate, 8000.0);
+		std::vector<int16_t> output;
+
+		resampler.process(input.data(), input.size(), output);
+
+		CHECK(output.size() == 16000);
+
+		// the tone passes with its level, skip the filter's start
+		double level = rms(output.data() + 1000, output.size() - 1000) / rms(input.data(), input.size());
+		CHECK((level > 0.97) && (level < 1.03));
+	}
+}
+
+//////////////////////////////////////////////
+//
+// the packet size must not change anything, not even the rounding
+//
+//////////////////////////////////////////////
+static void testResamplerPackets(void)
+{
+	std::vector<int16_t> input = sine(1000.0, 44100, 44100, 12000.0);
+	std::vector<int16_t> whole, pieces;
+
+	Resampler once(44100, 16000);
+	once.process(input.data(), input.size(), whole);
+
+	Resampler packets(44100, 16000);
+	size_t packetSizes[] = { 1, 7, 441, 160, 3, 1023 };
+	size_t pos = 0;
+
+	for (size_t i = 0; pos < input.size(); i++)
+	{
+		size_t length = std::min(packetSizes[i % 6], input.size() - pos);
+		packets.process(input.data() + pos, length, pieces);
+		pos += length;
+	}
+
+	CHECK(pieces == whole);
+
+	// reset() starts over with an empty filter
+	std::vector<int16_t> again;
+	once.reset();
+	once.process(input.data(), input.size(), again);
+	CHECK(again == whole);
+}
+
+//////////////////////////////////////////////
+static void testResamplerAliasing(void)
+{
+	// above the output's nyquist frequency, must not fold back into the band
+	Resampler resampler(48000, 16000);
+	std::vector<int16_t> input = sine(12000.0, 48000, 48000, 16000.0);
+	std::vector<int16_t> output;
+
+	resampler.process(input.data(), input.size(), output);
+
+	CHECK(rms(output.data() + 1000, output.size() - 1000) < (rms(input.data(), input.size()) / 100.0));
+}
+
+//////////////////////////////////////////////
+static void testFrameRing(void)
+{
+	VADFrameRing<4> ring(2);
+
+	// wrap around before growing
+	for (int i = 0; i < 3; i++)
+	{
+		ring.pushBack().number = i;
+	}
+	ring.popFront(2);
+	CHECK(ring.size() == 1);
+
+	for (int i = 3; i < 10; i++)
+	{
+		ring.pushBack().number = i;
+	}
+
+	CHECK(ring.size() == 8);
+	for (size_t i = 0; i < ring.size(); i++)
+	{
+		CHECK(ring[i].number == (unsigned long long) (i + 2));
+	}
+
+	ring.popFront(3);
+	CHECK(ring[0].number == 5);
+
+	ring.clear();
+	CHECK(ring.size() == 0);
+}
+
+//////////////////////////////////////////////
+//
+// silence never starts an utterance; every complete frame is counted once,
+// whatever the packet sizes, the incomplete one waits for the next packet
+//
+//////////////////////////////////////////////
+static void testVadFraming(void)
+{
+	Metrics& metrics = Metrics::getInstance();
+	VADWrapper vad(3, 16000, 5, 30, 50, true, -70);
+	std::vector<int16_t> silence(1000, 0);
+
+	uint64_t framesBefore = metrics.vadFrames.get();
+	uint64_t gatedBefore  = metrics.vadGatedFrames.get();
+
+	// 7 + 7 + ... : never a whole frame per call
+	size_t pos = 0;
+	while (pos < silence.size())
+	{
+		size_t length = std::min((size_t) 7, silence.size() - pos);
+		CHECK(vad.process(16000, silence.data() + pos, length) == 0);
+		pos += length;
+	}
+
+	CHECK((metrics.vadFrames.get() - framesBefore) == (silence.size() / VADWrapper::nrVADSamples));
+	CHECK((metrics.vadGatedFrames.get() - gatedBefore) == (silence.size() / VADWrapper::nrVADSamples));
+
+	// the remaining 40 samples plus 120 complete one more frame
+	CHECK(vad.process(16000, silence.data(), 120) == 0);
+	CHECK((metrics.vadFrames.get() - framesBefore) == (silence.size() / VADWrapper::nrVADSamples) + 1);
+
+	CHECK(vad.analyze() == true);
+	CHECK(vad.getUtteranceStatus() == VADWrapperState::IDLE);
+	CHECK(vad.getAvailableChunks() == 0);
+}
+
+//////////////////////////////////////////////
+//
+// a stream cut into packets of odd byte length, the first one included, goes
+// through AudioInput (the packet path of VoskRecognizer::acceptWaveform()):
+// after every packet exactly ceil(samples * 16000 / rate) samples of the
+// complete input samples must have reached the VAD, every complete 10 ms
+// frame of them classified, and the frames handed out must be the resampled
+// input (a lost or misplaced byte would scramble them)
+//
+//////////////////////////////////////////////
+static void testPacketStream(void)
+{
+	const int rates[] = { 48000, 44100, 8000 };
+	const size_t packetBytes[] = { 1, 3, 957, 1920, 35, 2883, 5, 2 };
+	
+	Metrics& metrics = Metrics::getInstance();
+	
+	for (int rate : rates)
+	{
+		VADWrapper vad(3, 16000, 5, 30, 50, false, -70);
+		AudioInput audioInput(rate, 16000, &vad);
+		std::vector<int16_t> input = sine(220.0, rate, 3 * rate, 6000.0);
+		const char *bytes = (const char*) input.data();
+		size_t nrBytes = input.size() * sizeof(int16_t);
+		
+		// what the recognizer should see
+		std::vector<int16_t> expected;
+		Resampler resampler(rate, 16000);
+		resampler.process(input.data(), input.size(), expected);
+		
+		uint64_t framesBefore = metrics.vadFrames.get();
+		size_t consumed = 0;
+		size_t fetched  = 0;
+		
+		for (size_t i = 0; consumed < nrBytes; i++)
+		{
+			size_t length = std::min(packetBytes[i % 8], nrBytes - consumed);
+			
+			CHECK(audioInput.process(bytes + consumed, length) == 0);
+			consumed += length;
+			
+			size_t resampled = ((consumed / 2) * 16000 + rate - 1) / rate;
+			CHECK((metrics.vadFrames.get() - framesBefore) == (resampled / VADWrapper::nrVADSamples));
+			
+			// what the VAD found is handed out, like the recognizer does
+			while (vad.analyze() == false)
+			{
+				for (unsigned int n = vad.getAvailableChunks(); n > 0; n--)
+				{
+					const VADFrame<VADWrapper::nrVADSamples>& chunk = vad.getNextChunk();
+					size_t start = chunk.number * VADWrapper::nrVADSamples;
+					
+					CHECK(std::equal(std::begin(chunk.samples), std::end(chunk.samples), expected.begin() + start));
+					fetched++;
+				}
+			}
+		}
+		
+		CHECK((metrics.vadFrames.get() - framesBefore) == (expected.size() / VADWrapper::nrVADSamples));
+		CHECK(expected.size() == 48000);
+		
+		if (fetched == 0)
+		{
+			fprintf(stderr, "packet_stream: no speech found at %d Hz, frame contents not checked\n", rate);
+		}
+	}
+}
+
+//////////////////////////////////////////////
+static void testAdpcm(void)
+{
+	// odd length: the last byte holds a single sample
+	std::vector<int16_t> input = sine(300.0, 16000, 4001, 8000.0);
+	std::vector<uint8_t> encoded(AdpcmCodec::encodedSize(input.size()));
+	std::vector<int16_t> decoded(input.size());
+
+	CHECK(encoded.size() == 2001);
+
+	AdpcmState encodeState, decodeState;
+	AdpcmCodec::encode(input.data(), input.size(), encodeState, encoded.data());
+	AdpcmCodec::decode(encoded.data(), decoded.size(), decodeState, decoded.data());
+
+	// once the step size has adapted, the error stays small
+	double errorSum = 0.0;
+	for (size_t i = 200; i < input.size(); i++)
+	{
+		double error = (double) decoded[i] - input[i];
+		errorSum += error * error;
+	}
+	CHECK(std::sqrt(errorSum / (input.size() - 200)) < (rms(input.data(), input.size()) / 20.0));
+
+	// encoding in pieces (of even length) with one state gives the same bytes
+	std::vector<uint8_t> pieces(encoded.size());
+	AdpcmState pieceState;
+	AdpcmCodec::encode(input.data(), 1000, pieceState, pieces.data());
+	AdpcmCodec::encode(input.data() + 1000, input.size() - 1000, pieceState, pieces.data() + 500);
+	CHECK(pieces == encoded);
+}
+
+//////////////////////////////////////////////
+class UnitTest
+{
+public:
+	const char *name;
+	void (*run)(void);
+};
+
+static const UnitTest tests[] = {
+	{ "config",             testConfig },
+	{ "resampler_rates",    testResamplerRates },
+	{ "resampler_packets",  testResamplerPackets },
+	{ "resampler_aliasing", testResamplerAliasing },
+	{ "frame_ring",         testFrameRing },
+	{ "vad_framing",        testVadFraming },
+	{ "packet_stream",      testPacketStream },
+	{ "adpcm",              testAdpcm },
+};
+
+//////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	for (const UnitTest& test : tests)
+	{
+		bool selected = (argc < 2);
+
+		for (int i = 1; i < argc; i++)
+		{
+			selected = selected || (strcmp(argv[i], test.name) == 0);
+		}
+
+		// the configuration is read once, whoever comes first
+		if ((selected == false) && (strcmp(test.name, "config") != 0))
+		{
+			continue;
+		}
+
+		int before = failures;
+		test.run();
+
+		if (selected == true)
+		{
+			printf("%-20s %s\n", test.name, (failures == before) ? "ok" : "FAILED");
+		}
+	}
+
+	return failures;
+}
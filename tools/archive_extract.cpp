@@ -0,0 +1,168 @@
+//////////////////////////////////////////////
+//
+// reads utterances from the AudioLogger archive (VOSK_LOG_ARCHIVE=1)
+//
+// archive_extract <segment>.idx                        list all utterances
+// archive_extract <segment>.idx <name> <output.raw>    extract one utterance
+//                                                      (16 kHz, 16 bit, mono)
+//
+// only the index is read line by line, the audio of the requested
+// utterance is read directly at its offset in <segment>.adpcm
+//
+// build from the repository root:
+// g++ -std=c++17 -O2 -I. tools/archive_extract.cpp AdpcmCodec.cpp -o archive_extract
+//
+//////////////////////////////////////////////
+
+#include <AdpcmCodec.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const size_t archiveHeaderBytes = 12;
+
+//////////////////////////////////////////////
+class IndexEntry
+{
+public:
+	size_t      offset;
+	size_t      bytes;
+	size_t      samples;
+	long long   startMs;
+	int         instanceId;
+	std::string name;
+	std::string text;
+};
+
+//////////////////////////////////////////////
+static bool parseIndexLine(const std::string& line, IndexEntry& entry)
+{
+	std::istringstream is(line);
+	std::string field;
+	std::vector<std::string> fields;
+	
+	while (std::getline(is, field, '\t'))
+	{
+		fields.push_back(field);
+	}
+	
+	if (fields.size() < 6)
+	{
+		return false;
+	}
+	
+	entry.offset     = std::stoull(fields[0]);
+	entry.bytes      = std::stoull(fields[1]);
+	entry.samples    = std::stoull(fields[2]);
+	entry.startMs    = std::stoll(fields[3]);
+	entry.instanceId = std::stoi(fields[4]);
+	entry.name       = fields[5];
+	entry.text       = (fields.size() > 6) ? fields[6] : "";
+	
+	return true;
+}
+
+//////////////////////////////////////////////
+static int extract(const std::string& indexFile, const IndexEntry& entry, const std::string& outputFile)
+{
+	std::string segmentFile = indexFile.substr(0, indexFile.size() - strlen(".idx")) + ".adpcm";
+	std::ifstream segment(segmentFile, std::ifstream::binary);
+	
+	if (segment.good() == false)
+	{
+		std::cout << "Cannot open segment " << segmentFile << std::endl;
+		return 1;
+	}
+	
+	std::vector<char> record(entry.bytes);
+	
+	segment.seekg(entry.offset);
+	segment.read(record.data(), record.size());
+	
+	if ((segment.good() == false) || (entry.bytes < archiveHeaderBytes) || (memcmp(record.data(), "VWA1", 4) != 0))
+	{
+		std::cout << "No valid utterance record at offset " << entry.offset << " of " << segmentFile << std::endl;
+		return 1;
+	}
+	
+	uint32_t   nrSamples;
+	AdpcmState state;
+	
+	memcpy(&nrSamples, record.data() + 4, sizeof(nrSamples));
+	memcpy(&state.predictor, record.data() + 8, sizeof(state.predictor));
+	state.stepIndex = (uint8_t) record[10];
+	
+	if ((archiveHeaderBytes + AdpcmCodec::encodedSize(nrSamples)) > entry.bytes)
+	{
+		std::cout << "Truncated utterance record at offset " << entry.offset << std::endl;
+		return 1;
+	}
+	
+	std::vector<int16_t> samples(nrSamples);
+	AdpcmCodec::decode((const uint8_t*) record.data() + archiveHeaderBytes, nrSamples, state, samples.data());
+	
+	std::ofstream output(outputFile, std::ofstream::binary);
+	output.write((const char*) samples.data(), samples.size() * sizeof(int16_t));
+	
+	if (output.good() == false)
+	{
+		std::cout << "Error writing " << outputFile << std::endl;
+		return 1;
+	}
+	
+	std::cout << "Extracted " << entry.name << " (" << nrSamples << " samples) to " << outputFile << ": " << entry.text << std::endl;
+	
+	return 0;
+}
+
+//////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	if ((argc != 2) && (argc != 4))
+	{
+		std::cout << "Usage: " << argv[0] << " <segment>.idx [<utterance name> <output.raw>]" << std::endl;
+		return 1;
+	}
+	
+	std::string indexFile = argv[1];
+	std::ifstream index(indexFile);
+	std::string line;
+	
+	if (index.good() == false)
+	{
+		std::cout << "Cannot open index " << indexFile << std::endl;
+		return 1;
+	}
+	
+	while (std::getline(index, line))
+	{
+		IndexEntry entry;
+		
+		if ((line.size() == 0) || (line[0] == '#') || (parseIndexLine(line, entry) == false))
+		{
+			continue;
+		}
+		
+		if (argc == 2)
+		{
+			printf("%s\t%lld\t%d\t%.2fs\t%s\n", entry.name.c_str(), entry.startMs, entry.instanceId, entry.samples / 16000.0, entry.text.c_str());
+		}
+		else if (entry.name == argv[2])
+		{
+			return extract(indexFile, entry, argv[3]);
+		}
+	}
+	
+	if (argc == 4)
+	{
+		std::cout << "Utterance " << argv[2] << " not found in " << indexFile << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
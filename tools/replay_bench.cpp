@@ -0,0 +1,619 @@
+//////////////////////////////////////////////
+//
+// replays recorded utterances (the .raw files written by AudioLogger, 16 kHz)
+// or synthetic speech-like audio through the vosk API, with many concurrent
+// sessions sending packets at the pace of a live stream, like the websocket
+// server does
+//
+// replay_bench [options] <model> [file.raw | directory]...
+//
+//   --sessions N     concurrent sessions (default 4)
+//   --rate HZ        sample rate of the streams (default 48000)
+//   --packet-ms MS   audio per accept_waveform call (default 20)
+//   --speed X        pacing, 1 = real time, 0 = as fast as possible (default 1)
+//   --repeat N       every session plays its utterances N times (default 1)
+//   --synthetic N    without files: N synthetic utterances per session (default 10)
+//   --gap-ms MS      silence after every utterance (default 1000)
+//   --audio-ctx-mode full|adaptive
+//                    encoder context, overrides audio_ctx_mode of the config
+//   --schedule fifo|edf|sjf
+//                    order of waiting utterances, overrides schedule_policy
+//   --check-samples  verify that every streamed sample reached the VAD, the
+//                    exit code is 2 if not
+//   --transcripts FILE
+//                    write every final result (session, number, JSON) to FILE,
+//                    e.g. to diff the text of two runs with different settings
+//
+// recordings are distributed round robin over the sessions and resampled to
+// the stream rate; latency is measured from the last packet of an utterance
+// until its (last) final result arrives; results are matched to utterances
+// by the start of their first word, so the sessions ask for word times (which
+// cost a little decode time), utterances without any text are left out
+//
+// build from the repository root with the same dependencies and flags as the
+// server (see Dockerfile), replacing asr_server.cpp by tools/replay_bench.cpp
+//
+//////////////////////////////////////////////
+
+#include <Log.h>
+#include <Metrics.h>
+#include <Resampler.h>
+
+extern "C" {
+#include "vosk_api.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+static const int recordingSampleRate = 16000;
+
+//////////////////////////////////////////////
+class BenchOptions
+{
+public:
+	int    sessions    = 4;
+	int    rate        = 48000;
+	int    packetMs    = 20;
+	double speed       = 1.0;
+	int    repeat      = 1;
+	int    synthetic   = 10;
+	int    gapMs       = 1000;
+
+	std::string audioCtxMode;
+	std::string schedulePolicy;
+	bool        checkSamples = false;
+	std::string transcriptPath;
+	std::string modelPath;
+	std::vector<std::string> inputs;
+};
+
+//////////////////////////////////////////////
+//
+// what one session measured, merged after all sessions are done
+//
+//////////////////////////////////////////////
+class SessionStats
+{
+public:
+	std::vector<double> latencies;
+	size_t packets      = 0;
+	size_t samples      = 0;
+	size_t results      = 0;
+	size_t utterances   = 0;
+	// utterances without a result (no text), not part of the latencies
+	size_t silentUtterances = 0;
+	// results that arrived before the end of their utterance was sent (pauses
+	// within a recording) or that matched no utterance
+	size_t earlyResults = 0;
+	// what the recognizer's resampler has to produce from the stream at 16 kHz
+	size_t resampledSamples = 0;
+	// final results in the order they arrived (only with --transcripts)
+	std::vector<std::string> transcripts;
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+// the VAD starts an utterance up to its pre-roll before the speech
+static const double matchToleranceSeconds = 0.5;
+
+//////////////////////////////////////////////
+//
+// one utterance of a session, where it starts in the stream and when its end
+// was sent and its last result arrived
+//
+//////////////////////////////////////////////
+class StreamedUtterance
+{
+public:
+	double startSeconds = 0.0;
+	bool   endSent      = false;
+	bool   hasResult    = false;
+	BenchClock::time_point sent;
+	BenchClock::time_point lastResult;
+};
+
+//////////////////////////////////////////////
+static bool readRaw(const std::string& path, std::vector<int16_t>& samples)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (in.good() == false)
+	{
+		return false;
+	}
+
+	std::streamsize size = in.tellg();
+	in.seekg(0);
+
+	samples.resize(size / sizeof(int16_t));
+	in.read((char *) samples.data(), samples.size() * sizeof(int16_t));
+
+	return true;
+}
+
+//////////////////////////////////////////////
+//
+// .raw files given directly or found in the given directories, sorted
+// so that every run distributes them the same way
+//
+//////////////////////////////////////////////
+static std::vector<std::string> collectRecordings(const std::vector<std::string>& inputs)
+{
+	std::vector<std::string> files;
+
+	for (const std::string& input : inputs)
+	{
+		if (std::filesystem::is_directory(input) == true)
+		{
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(input))
+			{
+				if ((entry.is_regular_file() == true) && (entry.path().extension() == ".raw"))
+				{
+					files.push_back(entry.path().string());
+				}
+			}
+		}
+		else
+		{
+			files.push_back(input);
+		}
+	}
+
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+//////////////////////////////////////////////
+//
+// voiced-sounding bursts: a few harmonics of a slowly gliding pitch with a
+// syllable-rate envelope and some noise, 1 to 4 seconds long
+//
+//////////////////////////////////////////////
+static std::vector<int16_t> synthesizeUtterance(std::mt19937& rng)
+{
+	std::uniform_real_distribution<double> lengthDist(1.0, 4.0);
+	std::uniform_real_distribution<double> pitchDist(100.0, 220.0);
+	std::normal_distribution<double> noiseDist(0.0, 300.0);
+
+	size_t length = (size_t) (lengthDist(rng) * recordingSampleRate);
+	double pitch  = pitchDist(rng);
+	double phase  = 0.0;
+
+	std::vector<int16_t> samples(length);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		double t = (double) i / recordingSampleRate;
+		double f0 = pitch * (1.0 + 0.1 * sin(2.0 * M_PI * 0.7 * t));
+		double envelope = 0.55 + 0.45 * sin(2.0 * M_PI * 4.0 * t);
+
+		phase += 2.0 * M_PI * f0 / recordingSampleRate;
+
+		double value = 0.0;
+		for (int h = 1; h <= 6; h++)
+		{
+			value += sin(h * phase) / h;
+		}
+
+		value = 6000.0 * envelope * value + noiseDist(rng);
+		samples[i] = (int16_t) std::max(-32768.0, std::min(32767.0, value));
+	}
+
+	return samples;
+}
+
+//////////////////////////////////////////////
+//
+// start of the first word of a final result (seconds since the session
+// started), negative without words
+//
+//////////////////////////////////////////////
+static double firstWordStart(const char *result)
+{
+	static const char key[] = "\"start\" : ";
+	const char *start = strstr(result, key);
+
+	return (start != nullptr) ? atof(start + strlen(key)) : -1.0;
+}
+
+//////////////////////////////////////////////
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.size() == 0)
+	{
+		return 0.0;
+	}
+
+	size_t index = (size_t) std::ceil(p * sorted.size()) - 1;
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+//////////////////////////////////////////////
+//
+// the recognizers must have resampled exactly what was streamed, and the VAD
+// must have classified all of it except the incomplete last 10 ms frame of
+// every session
+//
+//////////////////////////////////////////////
+static bool checkSamples(const BenchOptions& options, const SessionStats& total)
+{
+	Metrics& metrics = Metrics::getInstance();
+
+	size_t frameSamples = recordingSampleRate / 100;
+	size_t accepted     = (size_t) metrics.audioBytes.get() / sizeof(int16_t);
+	size_t resampled    = (size_t) metrics.resampledSamples.get();
+	size_t classified   = (size_t) metrics.vadFrames.get() * frameSamples;
+
+	bool acceptedOk   = (accepted == total.samples);
+	bool resampledOk  = (resampled == total.resampledSamples);
+	bool classifiedOk = (classified <= resampled) && ((resampled - classified) < ((size_t) options.sessions * frameSamples));
+
+	printf("samples sent     %10zu, accepted %zu %s\n", total.samples, accepted, (acceptedOk == true) ? "ok" : "MISMATCH");
+	printf("16 kHz expected  %10zu, resampled %zu %s\n", total.resampledSamples, resampled, (resampledOk == true) ? "ok" : "MISMATCH");
+	printf("VAD classified   %10zu, %zu left over %s\n", classified, resampled - std::min(classified, resampled), (classifiedOk == true) ? "ok" : "MISMATCH");
+
+	return (acceptedOk == true) && (resampledOk == true) && (classifiedOk == true);
+}
+
+//////////////////////////////////////////////
+//
+// one virtual client: streams its utterances (each followed by silence) in
+// packets, fetches results like the server does and times them
+//
+//////////////////////////////////////////////
+static void runSession(VoskModel *model, const BenchOptions& options, const std::vector<std::vector<int16_t>>& utterances,
+	BenchClock::time_point start, SessionStats& stats)
+{
+	VoskRecognizer *recognizer = vosk_recognizer_new(model, (float) options.rate);
+	Resampler resampler(recordingSampleRate, options.rate);
+
+	// word times tell which utterance a result belongs to
+	vosk_recognizer_set_words(recognizer, 1);
+
+	size_t packetSamples = (size_t) options.rate * options.packetMs / 1000;
+	std::vector<int16_t> gap((size_t) recordingSampleRate * options.gapMs / 1000, 0);
+	std::vector<int16_t> stream;
+
+	std::vector<StreamedUtterance> streamed;
+
+	// the result belongs to the latest utterance that started before its first word;
+	// the last result of the stream also holds the text of all utterances after that one
+	auto matchResult = [&](const char *result, bool endOfStream) {
+		BenchClock::time_point now = BenchClock::now();
+		double wordStart = firstWordStart(result);
+		size_t match = streamed.size();
+
+		if (options.transcriptPath.size() > 0)
+		{
+			stats.transcripts.push_back(result);
+		}
+
+		for (size_t i = 0; (wordStart >= 0.0) && (i < streamed.size()); i++)
+		{
+			if (streamed[i].startSeconds <= (wordStart + matchToleranceSeconds))
+			{
+				match = i;
+			}
+		}
+
+		if (match == streamed.size())
+		{
+			// an empty last result is normal, anything else is not
+			if ((endOfStream == false) || (wordStart >= 0.0))
+			{
+				stats.earlyResults++;
+			}
+			return;
+		}
+
+		if (streamed[match].endSent == false)
+		{
+			stats.earlyResults++;
+		}
+
+		for (size_t i = match; i < ((endOfStream == true) ? streamed.size() : (match + 1)); i++)
+		{
+			streamed[i].hasResult  = true;
+			streamed[i].lastResult = now;
+		}
+	};
+
+	// the server fetches the result right away, so do we
+	auto fetchResult = [&](void) {
+		const char *result = vosk_recognizer_result(recognizer);
+		stats.results++;
+
+		matchResult(result, false);
+	};
+
+	for (int r = 0; r < options.repeat; r++)
+	{
+		for (const std::vector<int16_t>& utterance : utterances)
+		{
+			stream.clear();
+			resampler.process(utterance.data(), utterance.size(), stream);
+			size_t utteranceEnd = stream.size();
+			resampler.process(gap.data(), gap.size(), stream);
+
+			streamed.emplace_back();
+			streamed.back().startSeconds = (double) stats.samples / options.rate;
+
+			for (size_t offset = 0; offset < stream.size(); offset += packetSamples)
+			{
+				size_t length = std::min(packetSamples, stream.size() - offset);
+
+				// live pacing: a packet is only available once its audio was "spoken"
+				if (options.speed > 0.0)
+				{
+					double streamSeconds = (double) (stats.samples + length) / options.rate;
+					std::this_thread::sleep_until(start + std::chrono::duration_cast<BenchClock::duration>(
+						std::chrono::duration<double>(streamSeconds / options.speed)));
+				}
+
+				int status = vosk_recognizer_accept_waveform(recognizer, (const char *) (stream.data() + offset), (int) (length * sizeof(int16_t)));
+
+				stats.packets++;
+				stats.samples += length;
+
+				if ((streamed.back().endSent == false) && ((offset + length) >= utteranceEnd))
+				{
+					streamed.back().sent    = BenchClock::now();
+					streamed.back().endSent = true;
+					stats.utterances++;
+				}
+
+				if (status == 1)
+				{
+					fetchResult();
+				}
+				else
+				{
+					vosk_recognizer_partial_result(recognizer);
+				}
+			}
+		}
+	}
+
+	// end of stream, everything not yet fetched comes with the last result
+	matchResult(vosk_recognizer_final_result(recognizer), true);
+
+	// the resampler keeps its phase across packets, so the whole stream yields
+	// one output sample per started 1/16000 s, independent of the packet sizes
+	stats.resampledSamples = (size_t) (((unsigned long long) stats.samples * recordingSampleRate + options.rate - 1) / options.rate);
+
+	// a result that arrived before the end was sent leaves no latency to measure
+	for (const StreamedUtterance& utterance : streamed)
+	{
+		if (utterance.hasResult == false)
+		{
+			stats.silentUtterances++;
+		}
+		else if (utterance.lastResult >= utterance.sent)
+		{
+			stats.latencies.push_back(std::chrono::duration<double>(utterance.lastResult - utterance.sent).count());
+		}
+	}
+
+	vosk_recognizer_free(recognizer);
+}
+
+//////////////////////////////////////////////
+static void usage(void)
+{
+	fprintf(stderr, "usage: replay_bench [--sessions N] [--rate HZ] [--packet-ms MS] [--speed X] [--repeat N]\n");
+	fprintf(stderr, "                    [--synthetic N] [--gap-ms MS] [--audio-ctx-mode full|adaptive]\n");
+	fprintf(stderr, "                    [--schedule fifo|edf|sjf] [--check-samples] [--transcripts FILE]\n");
+	fprintf(stderr, "                    <model> [file.raw | directory]...\n");
+}
+
+//////////////////////////////////////////////
+static bool parseOptions(int argc, char **argv, BenchOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+
+		if (arg == "--check-samples")
+		{
+			options.checkSamples = true;
+			continue;
+		}
+
+		if ((arg.rfind("--", 0) == 0) && ((i + 1) >= argc))
+		{
+			return false;
+		}
+
+		if (arg == "--sessions")       options.sessions  = atoi(argv[++i]);
+		else if (arg == "--rate")      options.rate      = atoi(argv[++i]);
+		else if (arg == "--packet-ms") options.packetMs  = atoi(argv[++i]);
+		else if (arg == "--speed")     options.speed     = atof(argv[++i]);
+		else if (arg == "--repeat")    options.repeat    = atoi(argv[++i]);
+		else if (arg == "--synthetic") options.synthetic = atoi(argv[++i]);
+		else if (arg == "--gap-ms")    options.gapMs     = atoi(argv[++i]);
+		else if (arg == "--audio-ctx-mode") options.audioCtxMode = argv[++i];
+		else if (arg == "--schedule") options.schedulePolicy = argv[++i];
+		else if (arg == "--transcripts") options.transcriptPath = argv[++i];
+		else if (arg.rfind("--", 0) == 0)
+		{
+			return false;
+		}
+		else if (options.modelPath.size() == 0)
+		{
+			options.modelPath = arg;
+		}
+		else
+		{
+			options.inputs.push_back(arg);
+		}
+	}
+
+	return ((options.modelPath.size() > 0) && (options.sessions > 0) && (options.rate > 0) && (options.packetMs > 0));
+}
+
+//////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+
+	if (parseOptions(argc, argv, options) == false)
+	{
+		usage();
+		return 1;
+	}
+
+	// keep the report readable unless asked otherwise
+	if (std::getenv("VOSK_LOG_LEVEL") == nullptr)
+	{
+		Log::setLevel(LOG_LEVEL_WARNING);
+	}
+
+	// read by the recognizer defaults, which are loaded with the first model
+	if (options.audioCtxMode.size() > 0)
+	{
+		setenv("VOSK_AUDIO_CTX_MODE", options.audioCtxMode.c_str(), 1);
+	}
+	if (options.schedulePolicy.size() > 0)
+	{
+		setenv("VOSK_SCHEDULE_POLICY", options.schedulePolicy.c_str(), 1);
+	}
+
+	std::vector<std::vector<std::vector<int16_t>>> sessionUtterances(options.sessions);
+	std::vector<std::string> files = collectRecordings(options.inputs);
+
+	if (files.size() > 0)
+	{
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			std::vector<int16_t> samples;
+			if ((readRaw(files[i], samples) == false) || (samples.size() == 0))
+			{
+				fprintf(stderr, "Skipping %s\n", files[i].c_str());
+				continue;
+			}
+			sessionUtterances[i % options.sessions].push_back(std::move(samples));
+		}
+	}
+	else
+	{
+		for (int s = 0; s < options.sessions; s++)
+		{
+			std::mt19937 rng(1234 + s);
+			for (int u = 0; u < options.synthetic; u++)
+			{
+				sessionUtterances[s].push_back(synthesizeUtterance(rng));
+			}
+		}
+	}
+
+	printf("%d sessions at %d Hz, %d ms packets, speed %.2f, %s\n", options.sessions, options.rate, options.packetMs, options.speed,
+		(files.size() > 0) ? (std::to_string(files.size()) + " recordings").c_str() : (std::to_string(options.synthetic) + " synthetic utterances per session").c_str());
+
+	VoskModel *model = vosk_model_new(options.modelPath.c_str());
+
+	std::vector<SessionStats> stats(options.sessions);
+	std::vector<std::thread> sessions;
+
+	BenchClock::time_point start = BenchClock::now();
+
+	for (int s = 0; s < options.sessions; s++)
+	{
+		// sessions don't start in lockstep, spread them over one second
+		BenchClock::time_point sessionStart = start + std::chrono::milliseconds((1000 * s) / options.sessions);
+
+		sessions.emplace_back([&, s, sessionStart] {
+			std::this_thread::sleep_until(sessionStart);
+			runSession(model, options, sessionUtterances[s], sessionStart, stats[s]);
+		});
+	}
+
+	for (auto& session : sessions)
+	{
+		session.join();
+	}
+
+	double wallSeconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+
+	vosk_model_free(model);
+
+	SessionStats total;
+	for (const SessionStats& s : stats)
+	{
+		total.latencies.insert(total.latencies.end(), s.latencies.begin(), s.latencies.end());
+		total.packets      += s.packets;
+		total.samples      += s.samples;
+		total.results      += s.results;
+		total.utterances   += s.utterances;
+		total.earlyResults += s.earlyResults;
+		total.silentUtterances += s.silentUtterances;
+		total.resampledSamples += s.resampledSamples;
+	}
+
+	std::sort(total.latencies.begin(), total.latencies.end());
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	double cpuSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+
+	double audioSeconds = (double) total.samples / options.rate;
+
+	Metrics& metrics = Metrics::getInstance();
+	double decodeAudioSeconds = metrics.decodeAudioSeconds.getSum();
+
+	printf("audio            %10.1f s in %zu packets, %zu utterances\n", audioSeconds, total.packets, total.utterances);
+	printf("wall time        %10.1f s\n", wallSeconds);
+	printf("throughput       %10.2f x real time (%.1f audio seconds per second)\n", audioSeconds / wallSeconds, audioSeconds / wallSeconds);
+	printf("results          %10zu (%zu before the end of their utterance), %zu utterances without text\n", total.results, total.earlyResults,
+		total.silentUtterances);
+	printf("latency p50      %10.3f s\n", percentile(total.latencies, 0.50));
+	printf("latency p90      %10.3f s\n", percentile(total.latencies, 0.90));
+	printf("latency p99      %10.3f s\n", percentile(total.latencies, 0.99));
+	printf("latency max      %10.3f s\n", (total.latencies.size() > 0) ? total.latencies.back() : 0.0);
+	printf("deadline misses  %10llu of %llu utterances\n", (unsigned long long) metrics.deadlineMisses.get(),
+		(unsigned long long) metrics.utteranceLatencySeconds.getCount());
+	printf("decodes          %10llu (%llu partial, %llu batches)\n", (unsigned long long) metrics.decodes.get(),
+		(unsigned long long) metrics.partialDecodes.get(), (unsigned long long) metrics.batchDecodes.get());
+	printf("decode RTF       %10.3f (whisper time / decoded audio)\n", (decodeAudioSeconds > 0.0) ? (metrics.decodeSeconds.getSum() / decodeAudioSeconds) : 0.0);
+	printf("audio ctx mean   %10.0f encoder frames per decode (1500 = full window)\n",
+		(metrics.decodeAudioCtx.getCount() > 0) ? (metrics.decodeAudioCtx.getSum() / metrics.decodeAudioCtx.getCount()) : 0.0);
+	if ((metrics.draftAccepted.get() + metrics.draftRescored.get() + metrics.draftBypassed.get()) > 0)
+	{
+		printf("draft model      %10llu accepted, %llu decoded again, %llu bypassed\n", (unsigned long long) metrics.draftAccepted.get(),
+			(unsigned long long) metrics.draftRescored.get(), (unsigned long long) metrics.draftBypassed.get());
+	}
+	printf("CPU RTF          %10.3f (process CPU time / streamed audio)\n", cpuSeconds / audioSeconds);
+	printf("peak RSS         %10.1f MiB\n", usage.ru_maxrss / 1024.0);
+
+	if (options.transcriptPath.size() > 0)
+	{
+		std::ofstream out(options.transcriptPath);
+
+		for (size_t s = 0; s < stats.size(); s++)
+		{
+			for (size_t r = 0; r < stats[s].transcripts.size(); r++)
+			{
+				out << s << "\t" << r << "\t" << stats[s].transcripts[r] << "\n";
+			}
+		}
+	}
+
+	if (options.checkSamples == true)
+	{
+		return checkSamples(options, total) ? 0 : 2;
+	}
+
+	return 0;
+}
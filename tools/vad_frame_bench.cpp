@@ -0,0 +1,142 @@
+//////////////////////////////////////////////
+//
+// microbenchmark: per-frame heap allocation (make_unique + deque, as used
+// before) versus the preallocated VADFrameRing with a reused logger buffer
+//
+// build from the repository root:
+// g++ -std=c++17 -O3 -I. tools/vad_frame_bench.cpp -o vad_frame_bench
+//
+//////////////////////////////////////////////
+
+#include <VADFrame.h>
+#include <VADFrameRing.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <new>
+#include <vector>
+
+static const std::size_t nrSamples        = 160;
+static const std::size_t framesPerPacket  = 2;    // 20 ms packets
+static const std::size_t framesPerUtt     = 300;  // 3 s utterances
+static const std::size_t totalFrames      = 2000000;
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+	allocations++;
+	void *p = std::malloc(size);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+static short input[nrSamples * framesPerPacket];
+
+//////////////////////////////////////////////
+static std::size_t runDeque(void)
+{
+	std::deque<std::unique_ptr<VADFrame<nrSamples>>> vadChunks;
+	std::deque<std::unique_ptr<VADFrame<nrSamples>>> loggerChunks;
+	std::size_t checksum = 0;
+	
+	for (std::size_t frame = 0; frame < totalFrames; frame += framesPerPacket)
+	{
+		for (std::size_t i = 0; i < framesPerPacket; i++)
+		{
+			std::unique_ptr<VADFrame<nrSamples>> chunk = std::make_unique<VADFrame<nrSamples>>();
+			memcpy(chunk->samples, input + i * nrSamples, sizeof(chunk->samples));
+			chunk->state = VADState::ACTIVE;
+			vadChunks.push_back(std::move(chunk));
+		}
+		
+		while (vadChunks.size() > 0)
+		{
+			std::unique_ptr<VADFrame<nrSamples>> chunk = std::move(vadChunks.front());
+			vadChunks.pop_front();
+			checksum += chunk->samples[0];
+			loggerChunks.push_back(std::move(chunk));
+		}
+		
+		if (loggerChunks.size() >= framesPerUtt)
+		{
+			loggerChunks.clear();
+		}
+	}
+	
+	return checksum;
+}
+
+//////////////////////////////////////////////
+static std::size_t runRing(void)
+{
+	VADFrameRing<nrSamples> vadChunks(64);
+	std::vector<short> loggerSamples;
+	std::size_t checksum = 0;
+	
+	for (std::size_t frame = 0; frame < totalFrames; frame += framesPerPacket)
+	{
+		for (std::size_t i = 0; i < framesPerPacket; i++)
+		{
+			VADFrame<nrSamples>& chunk = vadChunks.pushBack();
+			memcpy(chunk.samples, input + i * nrSamples, sizeof(chunk.samples));
+			chunk.state = VADState::ACTIVE;
+		}
+		
+		while (vadChunks.size() > 0)
+		{
+			const VADFrame<nrSamples>& chunk = vadChunks[0];
+			vadChunks.popFront();
+			checksum += chunk.samples[0];
+			loggerSamples.insert(loggerSamples.end(), std::begin(chunk.samples), std::end(chunk.samples));
+		}
+		
+		if (loggerSamples.size() >= framesPerUtt * nrSamples)
+		{
+			loggerSamples.clear();
+		}
+	}
+	
+	return checksum;
+}
+
+//////////////////////////////////////////////
+template<typename F> static void measure(const char *name, F run)
+{
+	std::size_t allocsBefore = allocations;
+	auto start = std::chrono::steady_clock::now();
+	
+	std::size_t checksum = run();
+	
+	auto end = std::chrono::steady_clock::now();
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	
+	printf("%-8s %8.1f ns/frame  %10zu allocations  (%.3f per frame)  checksum %zu\n",
+		name, ns / totalFrames, allocations - allocsBefore, (double) (allocations - allocsBefore) / totalFrames, checksum);
+}
+
+//////////////////////////////////////////////
+int main(void)
+{
+	for (std::size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++)
+	{
+		input[i] = (short) (i * 7);
+	}
+	
+	printf("%zu frames of %zu samples, %zu frames per packet, %zu frames per utterance\n", totalFrames, nrSamples, framesPerPacket, framesPerUtt);
+	
+	measure("deque", runDeque);
+	measure("ring", runRing);
+	
+	return 0;
+}
@@ -5,36 +5,48 @@
 #include <string.h>
 
 #include <VoskRecognizer.h>
+#include <VoskModel.h>
+#include <Log.h>
+#include <Metrics.h>
+#include <VoskConfig.h>
+
+#include <chrono>
 
 extern "C" {
 #include "vosk_api.h"
 }
 
-//////////////////////////////////////////////
-class VoskModel
-{
-public:
-	int         instanceId;
-	std::string modelPath;
-};
-
 static int voskModelInstanceId = 1;
 
 ///////////////////////////////////////////////
 //
 // the vosk server spawns one model only
 //
-// there is nothing to do here yet, just keep the configred model path
+// the model is shared by all recognizers, the whisper weights are loaded only once
 //
 //////////////////////////////////////////////
 VoskModel *vosk_model_new(const char *model_path)
 {
 	VoskModel* instance;
-	printf("vosk_model_new, path=%s, instance=%d.\n", model_path, voskModelInstanceId);
 	
-	instance = new VoskModel();
-	instance->instanceId = voskModelInstanceId;
-	instance->modelPath  = std::string(model_path);
+	// the server starts with the model, so read the configuration (including the log level) first
+	VoskConfig::getInstance();
+	
+	LOG_INFO << "vosk_model_new, path=" << model_path << ", instance=" << voskModelInstanceId;
+	
+	instance = new VoskModel(voskModelInstanceId, model_path);
+	
+	// cascade: a smaller model decodes first, the one given by the server only when needed
+	std::string draftPath = VoskConfig::getInstance().getString("draft_model", "");
+	if (draftPath.size() > 0)
+	{
+		LOG_INFO << "vosk_model_new, draft model " << draftPath;
+		
+		instance->setDraft(new VoskModel(voskModelInstanceId, draftPath.c_str()));
+	}
+	
+	// load now rather than when the first speaker talks
+	instance->preload();
 	
 	voskModelInstanceId++;
 	return instance;
@@ -43,13 +55,15 @@ VoskModel *vosk_model_new(const char *model_path)
 ///////////////////////////////////////////////
 //
 // likely to be never called by the server
+//
+// recognizers still alive keep the model loaded until they are freed
 // 
 //////////////////////////////////////////////
 void vosk_model_free(VoskModel *model)
 {
-	printf("vosk_model_free, instance=%d\n", model->instanceId);
+	LOG_INFO << "vosk_model_free, instance=" << model->getInstanceId();
 	
-	delete(model);
+	model->release();
 	
 	voskModelInstanceId--;
 }
@@ -62,14 +76,15 @@ void vosk_model_free(VoskModel *model)
 //
 // sample rate is set by the server (and defined as environment on the command line)
 //
-// TBD: might want to get rid of the fixed 1:1 assignment of recognizers to sessions
+// a recognizer is only the light per-session front end (resampler, VAD, results),
+// the heavy whisper states are shared by all sessions (see DecoderPool)
 // 
 //////////////////////////////////////////////
 VoskRecognizer *vosk_recognizer_new(VoskModel *model, float sample_rate)
 {
 	VoskRecognizer* instance;
 	
-	instance = new VoskRecognizer(model->instanceId, sample_rate, model->modelPath.c_str());
+	instance = new VoskRecognizer(model, sample_rate);
 	
 	return instance;
 }
@@ -87,15 +102,17 @@ void vosk_recognizer_free(VoskRecognizer *recognizer)
 ///////////////////////////////////////////////
 void vosk_recognizer_set_max_alternatives(VoskRecognizer *recognizer, int max_alternatives)
 {
-	// stub
-	printf("vosk_recognizer_set_max_alternatives, instance=%d, max_alternatives=%d.\n", recognizer->getInstanceId(), max_alternatives);
+	LOG_INFO << "vosk_recognizer_set_max_alternatives, instance=" << recognizer->getInstanceId() << ", max_alternatives=" << max_alternatives;
+	
+	recognizer->setMaxAlternatives(max_alternatives);
 }
 
 ///////////////////////////////////////////////
 void vosk_recognizer_set_words(VoskRecognizer *recognizer, int words)
 {
-	// stub
-	printf("vosk_recognizer_set_words, instance=%d, words=%d.\n", recognizer->getInstanceId(), words);
+	LOG_INFO << "vosk_recognizer_set_words, instance=" << recognizer->getInstanceId() << ", words=" << words;
+	
+	recognizer->setWords(words != 0);
 }
 
 ///////////////////////////////////////////////
@@ -105,15 +122,24 @@ void vosk_recognizer_set_words(VoskRecognizer *recognizer, int words)
 //////////////////////////////////////////////
 int vosk_recognizer_accept_waveform(VoskRecognizer *recognizer, const char *data, int length)
 {
-	printf("vosk_recognizer_accept_waveform, instance=%d, modelInstaceId=%d, length=%d, sampleRate=%.2f.\n", recognizer->getInstanceId(), recognizer->getModelInstanceId(), length, recognizer->getSampleRate());
+	LOG_TRACE << "vosk_recognizer_accept_waveform, instance=" << recognizer->getInstanceId() << ", modelInstanceId=" << recognizer->getModelInstanceId() << ", length=" << length << ", sampleRate=" << recognizer->getSampleRate();
+	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
+	int status = recognizer->acceptWaveform(data, length);
+	
+	Metrics& metrics = Metrics::getInstance();
+	metrics.audioPackets.inc();
+	metrics.audioBytes.inc((length > 0) ? length : 0);
+	metrics.acceptWaveformSeconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 	
-	return recognizer->acceptWaveform(data, length);
+	return status;
 }
 
 ////////////////////////////////////////////////
 const char *vosk_recognizer_partial_result(VoskRecognizer *recognizer)
 {
-	printf("vosk_recognizer_partial_result, instance=%d, modelInstaceId=%d\n", recognizer->getInstanceId(), recognizer->getModelInstanceId());
+	LOG_TRACE << "vosk_recognizer_partial_result, instance=" << recognizer->getInstanceId() << ", modelInstanceId=" << recognizer->getModelInstanceId();
 	
 	return recognizer->getPartialResult();
 }
@@ -121,7 +147,7 @@ const char *vosk_recognizer_partial_result(VoskRecognizer *recognizer)
 ////////////////////////////////////////////////
 const char *vosk_recognizer_result(VoskRecognizer *recognizer)
 {
-	printf("vosk_recognizer_result, instance=%d, modelInstaceId=%d\n", recognizer->getInstanceId(), recognizer->getModelInstanceId());
+	LOG_DEBUG << "vosk_recognizer_result, instance=" << recognizer->getInstanceId() << ", modelInstanceId=" << recognizer->getModelInstanceId();
 
 	return recognizer->getFinalResult();
 }
@@ -129,8 +155,8 @@ const char *vosk_recognizer_result(VoskRecognizer *recognizer)
 ////////////////////////////////////////////////
 const char *vosk_recognizer_final_result(VoskRecognizer *recognizer)
 {
-	// no special handling required, just forward
-	printf("vosk_recognizer_final_result, instance=%d, modelInstaceId=%d\n", recognizer->getInstanceId(), recognizer->getModelInstanceId());
-	return vosk_recognizer_result(recognizer);
+	// end of stream, so make sure all utterances handed over for decoding have their result
+	LOG_DEBUG << "vosk_recognizer_final_result, instance=" << recognizer->getInstanceId() << ", modelInstanceId=" << recognizer->getModelInstanceId();
+	return recognizer->getLastResult();
 }
 